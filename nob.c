@@ -28,6 +28,7 @@
 void build();
 void run();
 void check();
+void test();
 void clean();
 void build_vendor();
 void clean_vendor();
@@ -121,6 +122,9 @@ int main(int argc, char **argv) {
         else ifeq(arg, "check") {
             add_func(check);
         }
+        else ifeq(arg, "test") {
+            add_func(test);
+        }
         else ifeq(arg, "clean") {
             add_func(clean);
         }
@@ -239,6 +243,47 @@ void check() {
     printf("[✓] Syntax check passed.\n");
 }
 
+void test() {
+    // every package with tests in it
+    const char *packages[] = {
+        WMAC_SOURCE"/utils",
+        WMAC_SOURCE"/engine",
+    };
+
+    size_t p = 0;
+    for_range(p, 0, ARRAY_LEN(packages)) {
+        Cmd cmd = {0};
+        cmd_append(&cmd,
+            "odin",
+            "test",
+            packages[p],
+            WMAC_COLLECTIONS
+        );
+
+        if (sanitize_memory)  cmd_append(&cmd, "-sanitize:memory");
+        if (sanitize_address) cmd_append(&cmd, "-sanitize:address");
+        if (sanitize_thread)  cmd_append(&cmd, "-sanitize:thread");
+
+        if (debug) cmd_append(&cmd, "-debug");
+
+        // benchmarks run one test at a time, so they don't skew each other
+        if (benchmarks) {
+            cmd_append(&cmd, "-define:ENABLE_BENCHMARKS=true", "-define:ODIN_TEST_THREADS=1");
+        }
+
+        int i = 0;
+        for_range(i, 0, passed_args_count) {
+            cmd_append(&cmd, passed_args[i]);
+        }
+
+        cmd_print(cmd);
+        if (!cmd_run_sync(cmd)) exit(1);
+        cmd_free(cmd);
+    }
+
+    printf("[✓] Tests passed.\n");
+}
+
 void clean() {
     if (!call_for_all(WMAC_DESTINATION, delete_file, false)) {
         printf("[✗] Clean failed.\n");
@@ -273,6 +318,7 @@ void show_help() {
         "  build     Build the project\n"
         "  run       Run the project\n"
         "  check     Check the syntax of the project\n"
+        "  test      Run the tests (and the benchmarks, with -bench)\n"
         "  clean     Clean the project\n"
         "  help      Show this help message\n"
         "\n"
@@ -11,76 +11,52 @@ layout(std430, binding = 3) buffer ssbo {
     ivec4 chunkPositions[];
 };
 
+// the axes a face's quads span, same as FACE_AXES in mesher.odin
+const vec3 U_AXIS[6] = vec3[6](
+    vec3(0, 0, 1), vec3(1, 0, 0), // north, south
+    vec3(0, 0, 1), vec3(1, 0, 0), // east, west
+    vec3(1, 0, 0), vec3(1, 0, 0)  // top, bottom
+);
+const vec3 V_AXIS[6] = vec3[6](
+    vec3(0, 1, 0), vec3(0, 1, 0),
+    vec3(0, 1, 0), vec3(0, 1, 0),
+    vec3(0, 0, 1), vec3(0, 0, 1)
+);
+
 vec3 pos;
-int normal;
+int face;
 ivec2 size;
-vec2 tex; 
+vec2 tex;
 
+// see create_mesh_data
 void unpack() {
     pos = vec3(
-        data.x & 0x0F,
-        (data.x >> 4) & 0x0F,
-        (data.x >> 8) & 0x0F
+        data.x & 0x1F,
+        (data.x >> 5) & 0x1F,
+        (data.x >> 10) & 0x1F
     );
     size = ivec2(
-        ((data.x >> 12) & 0x0F) + 1,
-        ((data.x >> 16) & 0x0F) + 1
+        (data.x >> 15) & 0x1F,
+        (data.x >> 20) & 0x1F
     );
-    normal = (data.x >> 20) & 0x07;
+    face = (data.x >> 25) & 0x07;
     tex = vec2(
-        (data.y & 0x0F) / 16.0,
-        (data.y >> 4) / 16.0
+        data.y & 0xFFFF,
+        (data.y >> 16) & 0xFFFF
     );
-    if (normal < 3) {
-        pos[normal] += 1;
-    }
 }
 
 void main() {
     unpack();
 
-    vec3 vertPos = vec3(
-        1-(gl_VertexID & 1),
-        (gl_VertexID>>1 & 1),
-        0
-    );
-    
-    if (normal < 2 || normal == 5) {
-        fragTexCoord = vec2(
-            (gl_VertexID & 1) != 0 ? tex.y : tex.y + 1,
-            (gl_VertexID & 2) != 0 ? tex.x : tex.x + 1
-        );
-        fragSize = size;
-    } else {
-        fragTexCoord = vec2(
-            (gl_VertexID & 2) != 0 ? tex.x : tex.x + 1,
-            (gl_VertexID & 1) != 1 ? tex.y : tex.y + 1
-        );
-        fragSize = size.yx;
-    }
-
+    vec2 corner = vec2(gl_VertexID & 1, (gl_VertexID >> 1) & 1);
+    vec3 vertPos = pos
+        + U_AXIS[face] * (corner.x * size.x)
+        + V_AXIS[face] * (corner.y * size.y);
 
-    vec3 newVertPos = vec3(vertPos.x*size.x, vertPos.y*size.y, vertPos.z);
-    switch (normal) {
-        case 0:
-            newVertPos = newVertPos.zyx;
-            break;
-        case 1:
-            newVertPos = newVertPos.xzy;
-            break;
-        case 2:
-            newVertPos = newVertPos.yxz;
-            break;
-        case 3:
-            newVertPos = newVertPos.zxy;
-            break;
-        case 4:
-            newVertPos = newVertPos.yzx;
-            break;
-        case 5:
-            newVertPos = newVertPos.xyz;
-            break;
-    }
+    // keep the textures on the sides upright
+    fragTexCoord = tex + vec2(corner.x, face < 4 ? 1.0 - corner.y : corner.y);
+    fragSize = size;
 
-    gl_Position = mvp*vec4(pos + newVertPos + (chunkPositions[gl_DrawID].xyz * 16.0), 1.0);
-}
\ No newline at end of file
+    gl_Position = mvp*vec4(vertPos + (chunkPositions[gl_DrawID].xyz * 16.0), 1.0);
+}
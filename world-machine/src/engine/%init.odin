@@ -25,15 +25,25 @@ WINDOW_SIZE := [2]i32{800, 450}
 @(private) _world_should_update := false
 @(private) _world_thread : ^thread.Thread
 
+// Number of job threads. 0 picks one per core, minus the one
+// the main thread is sitting on.
+WORKER_THREADS := 0
+
+// Shared by world generation, meshing and ticks.
+_jobs : utils.JobSystem
+
 init::proc() {
     utils.init_engine_signals()
     utils.init_logger()
+    utils.init_profiler()
 
     set_ext_vars()
     init_sdl()
     
     do_requirement_checks()
 
+    init_jobs()
+
     load_all_mods()
     init_mod_functions()
     
@@ -52,6 +62,20 @@ init::proc() {
     _world_thread = thread.create_and_start(world_loop)
 }
 
+init_jobs::proc() {
+    count := WORKER_THREADS
+    if count <= 0 do count = max(os.processor_core_count() - 1, 1)
+
+    utils.init_job_system(&_jobs, count)
+    utils.log(.INFO, "Started", count, "job threads")
+
+    utils.defer_deinit(deinit_jobs)
+}
+
+deinit_jobs::proc() {
+    utils.destroy_job_system(&_jobs)
+}
+
 init_sdl::proc() {
     init_flags := sdl.InitFlags{
         .VIDEO,
@@ -104,15 +128,16 @@ init_sdl::proc() {
 }
 
 deinit::proc() {
+    // ticks touch the world, so they have to stop before it goes away
+    stop_tick_loop()
     utils.deinit_everything()
 
-    _world_should_tick = false
     _world_should_update = false
 
     sdl.DestroyWindow(_window)
     sdl.Quit()
 
-    thread.join_multiple(_ticks_thread, _world_thread)
+    thread.join(_world_thread)
 
     os.exit(0)
 }
@@ -36,6 +36,8 @@ main_loop::proc() {
     _last_frame_tick = time.tick_now()
     
     for (_window_should_close == false) {
+        // last frame's scopes, before this frame's root opens
+        utils.collect_profile()
         utils.bench("main_loop")
 
         gl.Viewport(0, 0, WINDOW_SIZE[0], WINDOW_SIZE[1])
@@ -43,6 +45,8 @@ main_loop::proc() {
         gl.Clear(gl.COLOR_BUFFER_BIT)
         
         handle_events()
+        utils.flush_deferred_signals()
+        update_load_center()
         render()
         draw_ui()
         update_framerate()
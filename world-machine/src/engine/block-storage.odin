@@ -0,0 +1,216 @@
+package engine
+
+import "core:slice"
+
+BLOCKS_PER_CHUNK :: 16*16*16
+
+// Blocks of a chunk as indices into a palette, packed `bits` wide into
+// 64 bit words. The width is always 0, 1, 2, 4, 8 or 16 so an index never
+// straddles two words. Chunks that are all one block (air or stone, most
+// of them) have a width of 0 and a single word of data that's never read
+// past, so lookups don't need a special case for them.
+//
+// Not safe to modify while other threads read it.
+BlockStorage::struct {
+    palette: [dynamic]BlockID,
+    counts: [dynamic]u16, // blocks using each palette entry, 0 means the entry is free
+    data: []u64,
+    bits: u32,
+    mask: u64,
+    modified: bool, // changed since it was generated or loaded, needs saving
+}
+
+block_storage_get::#force_inline proc(s: ^BlockStorage, #any_int i: int) -> BlockID {
+    return s.palette[read_palette_index(s, i)]
+}
+
+// Where the block is in the palette, saving wants the raw indices.
+block_storage_index::#force_inline proc(s: ^BlockStorage, #any_int i: int) -> u32 {
+    return read_palette_index(s, i)
+}
+
+// Returns the block that was there before.
+block_storage_set::proc(s: ^BlockStorage, #any_int i: int, id: BlockID) -> (old: BlockID) {
+    old_idx := read_palette_index(s, i)
+    old = s.palette[old_idx]
+    if old == id do return old
+
+    new_idx := find_or_add_to_palette(s, id)
+    write_palette_index(s, i, new_idx)
+    s.counts[new_idx] += 1
+    s.counts[old_idx] -= 1
+    s.modified = true
+
+    if s.counts[old_idx] == 0 do shrink_palette(s)
+    return old
+}
+
+// Fills the storage from a chunk layout, it can hold anything before.
+block_storage_fill::proc(s: ^BlockStorage, layout: []BlockID) {
+    assert(len(layout) == BLOCKS_PER_CHUNK)
+    clear(&s.palette)
+    clear(&s.counts)
+    s.modified = false
+
+    // the unique blocks, sorted so they can be binary searched below
+    sorted := slice.clone(layout, context.temp_allocator)
+    slice.sort(sorted)
+    for id, i in sorted {
+        if i == 0 || id != sorted[i-1] do append(&s.palette, id)
+    }
+    resize(&s.counts, len(s.palette))
+
+    // whatever it held gets written over, no point in repacking it first
+    set_palette_width(s, palette_width(len(s.palette)), keep_blocks = false)
+
+    // neighbouring blocks are mostly the same, which skips most searches
+    last_id := layout[0]
+    first, _ := slice.binary_search(s.palette[:], last_id)
+    last_idx := u32(first)
+    for id, i in layout {
+        if id != last_id {
+            idx, _ := slice.binary_search(s.palette[:], id)
+            last_id, last_idx = id, u32(idx)
+        }
+        write_palette_index(s, i, last_idx)
+        s.counts[last_idx] += 1
+    }
+}
+
+block_storage_reset::proc(s: ^BlockStorage) {
+    clear(&s.palette)
+    clear(&s.counts)
+    s.modified = false
+}
+
+block_storage_destroy::proc(s: ^BlockStorage) {
+    delete(s.palette)
+    delete(s.counts)
+    delete(s.data)
+    s^ = {}
+}
+
+// Decodes every block at once, the mesher wants them all anyway.
+block_storage_decode::proc(s: ^BlockStorage, out: []BlockID) {
+    if s.bits == 0 {
+        slice.fill(out, s.palette[0])
+        return
+    }
+    per_word := 64 / int(s.bits)
+    #no_bounds_check for w in 0..<len(s.data) {
+        word := s.data[w]
+        for j in 0..<per_word {
+            out[w*per_word + j] = s.palette[word & s.mask]
+            word >>= s.bits
+        }
+    }
+}
+
+// Heap memory the storage holds on to, including what's only reserved.
+block_storage_bytes::proc(s: ^BlockStorage) -> int {
+    return size_of(BlockStorage) +
+        cap(s.palette) * size_of(BlockID) +
+        cap(s.counts) * size_of(u16) +
+        len(s.data) * size_of(u64)
+}
+
+@(private="file")
+read_palette_index::#force_inline proc(s: ^BlockStorage, i: int) -> u32 {
+    bit := uint(i) * uint(s.bits)
+    return u32((s.data[bit >> 6] >> (bit & 63)) & s.mask)
+}
+
+@(private="file")
+write_palette_index::#force_inline proc(s: ^BlockStorage, i: int, idx: u32) {
+    bit := uint(i) * uint(s.bits)
+    word := &s.data[bit >> 6]
+    word^ = (word^ &~ (s.mask << (bit & 63))) | (u64(idx) << (bit & 63))
+}
+
+@(private="file")
+palette_width::proc(entries: int) -> u32 {
+    switch {
+    case entries <= 1:   return 0
+    case entries <= 2:   return 1
+    case entries <= 4:   return 2
+    case entries <= 16:  return 4
+    case entries <= 256: return 8
+    }
+    return 16
+}
+
+// Switches to a new width, keeping the blocks unless told not to, then
+// they all read as palette index 0. `remap` translates old palette indices
+// to new ones, if the palette got rearranged.
+@(private="file")
+set_palette_width::proc(s: ^BlockStorage, bits: u32, remap: []u32 = nil, keep_blocks := true) {
+    words := max(BLOCKS_PER_CHUNK * int(bits) / 64, 1)
+    old := s^
+
+    if len(s.data) != words || remap != nil {
+        s.data = make([]u64, words)
+    } else {
+        slice.zero(s.data)
+    }
+    s.bits = bits
+    s.mask = (u64(1) << bits) - 1
+
+    if keep_blocks && old.data != nil && (old.bits != bits || remap != nil) {
+        for i in 0..<BLOCKS_PER_CHUNK {
+            idx := read_palette_index(&old, i)
+            if remap != nil do idx = remap[idx]
+            write_palette_index(s, i, idx)
+        }
+    }
+    if raw_data(old.data) != raw_data(s.data) do delete(old.data)
+}
+
+@(private="file")
+find_or_add_to_palette::proc(s: ^BlockStorage, id: BlockID) -> u32 {
+    free_idx := -1
+    for entry, i in s.palette {
+        if s.counts[i] == 0 {
+            if free_idx < 0 do free_idx = i
+            continue
+        }
+        if entry == id do return u32(i)
+    }
+
+    if free_idx >= 0 {
+        s.palette[free_idx] = id
+        return u32(free_idx)
+    }
+
+    append(&s.palette, id)
+    append(&s.counts, 0)
+    if bits := palette_width(len(s.palette)); bits != s.bits do set_palette_width(s, bits)
+    return u32(len(s.palette) - 1)
+}
+
+// Drops the unused palette entries once the rest fits a narrower width.
+// Waits until it can drop a whole width step, so a block flipping back and
+// forth doesn't repack the chunk every time.
+@(private="file")
+shrink_palette::proc(s: ^BlockStorage) {
+    used := 0
+    for count in s.counts {
+        if count != 0 do used += 1
+    }
+
+    bits := palette_width(used)
+    if bits >= s.bits do return
+
+    remap := make([]u32, len(s.palette), context.temp_allocator)
+    n := 0
+    for i in 0..<len(s.palette) {
+        if s.counts[i] == 0 do continue
+        remap[i] = u32(n)
+        s.palette[n] = s.palette[i]
+        s.counts[n] = s.counts[i]
+        n += 1
+    }
+    resize(&s.palette, n)
+    resize(&s.counts, n)
+
+    set_palette_width(s, bits, remap)
+}
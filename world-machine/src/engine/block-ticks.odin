@@ -0,0 +1,343 @@
+package engine
+
+import "base:runtime"
+
+import "core:slice"
+import "core:sync"
+
+import "src:utils"
+
+// Blocks that do something on their own (crops, fluids, redstone-ish stuff)
+// register a tick handler. Two kinds of ticks reach them:
+//
+//  - scheduled: "tick this block again in N ticks", kept in a timing wheel
+//    so scheduling and firing are O(1) no matter how many are pending.
+//  - random: every tick, RANDOM_TICKS_PER_CHUNK random spots of each chunk
+//    get picked, and the ones holding a tickable block get ticked.
+//
+// Chunks only take part in random ticks while they hold tickable blocks.
+// Those are tracked in a sparse set per chunk, updated whenever the
+// chunk's blocks change. A chunk whose palette has nothing tickable in it
+// doesn't even get looked at, so the cost of a tick follows the number of
+// active chunks and pending ticks, not how much of the world is loaded.
+
+BlockTickKind::enum u8 {
+    RANDOM,
+    SCHEDULED,
+}
+
+BlockTickProc::proc "c" (at: BlockPos, id: BlockID, kind: BlockTickKind)
+
+// The world is cut into tick regions of 2x2x2 chunks, and the regions into 8
+// phases by the parity of their position, checkerboard style. Regions of the
+// same phase are a whole region apart, so as long as handlers stay within
+// TICK_REACH blocks of the block they tick, a phase's regions can all run at
+// once on the job threads. The phases run one after another. Ticks inside a
+// region run in position order, so a tick comes out the same no matter how
+// many threads run it.
+TICK_REGION_SHIFT :: 5 // log2 of the region size in blocks
+TICK_REACH :: (1 << TICK_REGION_SHIFT) / 2 - 1
+
+// Runs every tick on the tick thread instead, in the same order.
+PARALLEL_TICKS := true
+
+// Same odds per block as picking this many blocks of every chunk at random.
+RANDOM_TICKS_PER_CHUNK :: 3
+
+// Ticks scheduled further out than this go around the wheel more than once.
+TICK_WHEEL_SIZE :: 256
+
+// Tickable blocks of a chunk, by block index. `sparse` holds each block's
+// slot in `dense` plus one, 0 for blocks that aren't in the set.
+@(private="file")
+ActiveBlockSet::struct {
+    dense: [dynamic]u16,
+    sparse: [BLOCKS_PER_CHUNK]u16,
+}
+
+@(private="file")
+ScheduledTick::struct {
+    pos: BlockPos,
+    due: u64,
+}
+
+// Indexed by block id, nil for blocks that don't tick. Only written while
+// the mods load, so reading it doesn't need the lock.
+@(private="file") _tick_handlers : [dynamic]BlockTickProc
+
+@(private="file") _active_blocks : map[ChunkPos]^ActiveBlockSet
+@(private="file") _tick_wheel : [TICK_WHEEL_SIZE][dynamic]ScheduledTick
+@(private="file") _scheduled : map[BlockPos]u64 // when each pending tick is due, so blocks aren't scheduled twice
+@(private="file") _current_tick : u64
+@(private="file") _due_scheduled, _due_random : [dynamic]BlockPos // reused every tick, tick thread only
+@(private="file") _block_ticks_lock : sync.Mutex
+
+register_tickable_block::proc(id: BlockID, handler: BlockTickProc) {
+    if int(id) >= len(_tick_handlers) do resize(&_tick_handlers, int(id) + 1)
+    _tick_handlers[id] = handler
+}
+
+is_tickable::#force_inline proc(id: BlockID) -> bool {
+    return int(id) < len(_tick_handlers) && _tick_handlers[id] != nil
+}
+
+// Ticks the block `delay` ticks from now, unless it's already due sooner.
+// Safe to call from any thread, tick handlers included.
+schedule_block_tick::proc(at: BlockPos, delay: u32) {
+    delay := max(delay, 1)
+
+    sync.mutex_lock(&_block_ticks_lock)
+    defer sync.mutex_unlock(&_block_ticks_lock)
+
+    due := _current_tick + u64(delay)
+    if pending, ok := _scheduled[at]; ok && pending <= due do return
+    _scheduled[at] = due
+    append(&_tick_wheel[due % TICK_WHEEL_SIZE], ScheduledTick{at, due})
+}
+
+// Picks everything that ticks this tick. The lists are only good until the
+// next call, and not in the temp allocator on purpose: jobs the tick thread
+// helps with while it waits use that too.
+collect_block_ticks::proc() -> (scheduled, random: []BlockPos) {
+    if len(_tick_handlers) == 0 do return
+
+    clear(&_due_scheduled)
+    clear(&_due_random)
+
+    sync.mutex_lock(&_block_ticks_lock)
+    defer sync.mutex_unlock(&_block_ticks_lock)
+
+    _current_tick += 1
+    collect_scheduled_ticks(&_due_scheduled)
+    collect_random_ticks(&_due_random)
+    return _due_scheduled[:], _due_random[:]
+}
+
+// Runs the ticks phase by phase, sorting `due` in the process.
+run_block_ticks::proc(due: []BlockPos, kind: BlockTickKind) {
+    if len(due) == 0 do return
+
+    TickRegionJob :: struct {
+        due: []BlockPos,
+        kind: BlockTickKind,
+    }
+    job_proc :: proc(job: ^TickRegionJob) {
+        // handlers run without any locks, they're free to edit and schedule
+        for pos in job.due {
+            id := get_block(pos)
+            if !is_tickable(id) do continue // it changed since
+            _tick_handlers[id](pos, id, job.kind)
+        }
+    }
+
+    slice.sort_by(due, proc(a, b: BlockPos) -> bool {
+        if pa, pb := tick_phase(a), tick_phase(b); pa != pb do return pa < pb
+        if ra, rb := tick_region(a), tick_region(b); ra != rb do return position_less(ra, rb)
+        return position_less(a, b)
+    })
+
+    group : utils.JobGroup
+    regions := make([dynamic]TickRegionJob)
+    defer delete(regions)
+    jobs := make([dynamic]utils.Job)
+    defer delete(jobs)
+
+    for i := 0; i < len(due); {
+        phase := tick_phase(due[i])
+        clear(&regions)
+        for i < len(due) && tick_phase(due[i]) == phase {
+            region := tick_region(due[i])
+            end := i + 1
+            for end < len(due) && tick_region(due[end]) == region do end += 1
+            append(&regions, TickRegionJob{due[i:end], kind})
+            i = end
+        }
+
+        if !PARALLEL_TICKS || len(regions) == 1 {
+            for &region in regions do job_proc(&region)
+            continue
+        }
+
+        clear(&jobs)
+        for region in regions do append(&jobs, utils.make_job(job_proc, region, &group))
+        utils.submit_batch(&_jobs, jobs[:])
+        utils.wait_for_group(&_jobs, &group)
+    }
+}
+
+@(private="file")
+tick_region::#force_inline proc(pos: BlockPos) -> [3]i32 {
+    return {pos.x >> TICK_REGION_SHIFT, pos.y >> TICK_REGION_SHIFT, pos.z >> TICK_REGION_SHIFT}
+}
+
+@(private="file")
+tick_phase::#force_inline proc(pos: BlockPos) -> int {
+    r := tick_region(pos)
+    return int(r.x & 1) | int(r.y & 1) << 1 | int(r.z & 1) << 2
+}
+
+@(private="file")
+position_less::#force_inline proc(a, b: [3]i32) -> bool {
+    if a.z != b.z do return a.z < b.z
+    if a.y != b.y do return a.y < b.y
+    return a.x < b.x
+}
+
+// Call whenever a single block changes.
+update_active_block::proc(pos: ChunkPos, #any_int index: int, from, to: BlockID) {
+    was, is := is_tickable(from), is_tickable(to)
+    if was == is do return
+
+    sync.mutex_lock(&_block_ticks_lock)
+    defer sync.mutex_unlock(&_block_ticks_lock)
+
+    set := _active_blocks[pos]
+    if is {
+        if set == nil {
+            set = new(ActiveBlockSet)
+            _active_blocks[pos] = set
+        }
+        add_active_block(set, u16(index))
+    } else if set != nil {
+        remove_active_block(set, u16(index))
+        if len(set.dense) == 0 do drop_active_blocks_locked(pos)
+    }
+}
+
+// Call whenever a lot of the chunk changes at once, or it gets loaded. The
+// caller needs the storage to itself.
+refresh_active_blocks::proc(pos: ChunkPos, storage: ^BlockStorage) {
+    if len(_tick_handlers) == 0 do return
+
+    any_tickable := false
+    for id, i in storage.palette {
+        if storage.counts[i] > 0 && is_tickable(id) do any_tickable = true
+    }
+
+    sync.mutex_lock(&_block_ticks_lock)
+    defer sync.mutex_unlock(&_block_ticks_lock)
+
+    drop_active_blocks_locked(pos)
+    if !any_tickable do return
+
+    blocks : ChunkBlocks
+    block_storage_decode(storage, blocks[:])
+
+    set := new(ActiveBlockSet)
+    for id, i in blocks {
+        if is_tickable(id) do add_active_block(set, u16(i))
+    }
+    _active_blocks[pos] = set
+}
+
+drop_active_blocks::proc(pos: ChunkPos) {
+    if len(_tick_handlers) == 0 do return
+
+    sync.mutex_lock(&_block_ticks_lock)
+    defer sync.mutex_unlock(&_block_ticks_lock)
+    drop_active_blocks_locked(pos)
+}
+
+// Leaves nothing behind, the tick count starts over too.
+destroy_block_ticks::proc() {
+    for _, set in _active_blocks {
+        delete(set.dense)
+        free(set)
+    }
+    delete(_active_blocks)
+    for &slot in _tick_wheel do delete(slot)
+    delete(_scheduled)
+    delete(_due_scheduled)
+    delete(_due_random)
+    delete(_tick_handlers)
+
+    _active_blocks, _scheduled = nil, nil
+    _tick_wheel = {}
+    _due_scheduled, _due_random, _tick_handlers = nil, nil, nil
+    _current_tick = 0
+}
+
+@(private="file")
+collect_scheduled_ticks::proc(out: ^[dynamic]BlockPos) {
+    slot := &_tick_wheel[_current_tick % TICK_WHEEL_SIZE]
+    kept := 0
+    for scheduled in slot {
+        if scheduled.due > _current_tick {
+            // another lap around the wheel to go
+            slot[kept] = scheduled
+            kept += 1
+            continue
+        }
+        // it was rescheduled sooner and this one is stale
+        if _scheduled[scheduled.pos] != scheduled.due do continue
+
+        delete_key(&_scheduled, scheduled.pos)
+        append(out, scheduled.pos)
+    }
+    resize(slot, kept)
+}
+
+@(private="file")
+collect_random_ticks::proc(out: ^[dynamic]BlockPos) {
+    for pos, set in _active_blocks {
+        // seeded by the chunk and the tick, so the same world always ticks the same way
+        rng := (u64(_current_tick) * 0x9E3779B97F4A7C15 ~ hash_chunk_pos(pos)) | 1 // xorshift gets stuck on 0
+        for _ in 0..<RANDOM_TICKS_PER_CHUNK {
+            rng ~= rng << 13
+            rng ~= rng >> 7
+            rng ~= rng << 17
+            index := int(rng % BLOCKS_PER_CHUNK)
+            if set.sparse[index] == 0 do continue
+
+            x, y, z := (index / 16) % 16, index % 16, index / 256
+            append(out, pos * 16 + BlockPos{i32(x), i32(y), i32(z)})
+        }
+    }
+}
+
+@(private="file")
+hash_chunk_pos::#force_inline proc(pos: ChunkPos) -> u64 {
+    return u64(u32(pos.x)) * 0x8DA6B343 ~ u64(u32(pos.y)) * 0xD8163841 ~ u64(u32(pos.z)) * 0xCB1AB31F
+}
+
+@(private="file")
+add_active_block::proc(set: ^ActiveBlockSet, index: u16) {
+    if set.sparse[index] != 0 do return
+    append(&set.dense, index)
+    set.sparse[index] = u16(len(set.dense))
+}
+
+@(private="file")
+remove_active_block::proc(set: ^ActiveBlockSet, index: u16) {
+    slot := set.sparse[index]
+    if slot == 0 do return
+
+    // the last one takes its place
+    last := pop(&set.dense)
+    if last != index {
+        set.dense[slot - 1] = last
+        set.sparse[last] = slot
+    }
+    set.sparse[index] = 0
+}
+
+@(private="file")
+drop_active_blocks_locked::proc(pos: ChunkPos) {
+    set, ok := _active_blocks[pos]
+    if !ok do return
+    delete(set.dense)
+    free(set)
+    delete_key(&_active_blocks, pos)
+}
+
+@(private)
+api_register_tickable_block::proc "c" (id: BlockID, handler: BlockTickProc) {
+    context = runtime.default_context()
+    register_tickable_block(id, handler)
+}
+
+@(private)
+api_schedule_block_tick::proc "c" (at: BlockPos, delay: u32) {
+    context = runtime.default_context()
+    schedule_block_tick(at, delay)
+}
@@ -0,0 +1,260 @@
+package engine
+
+import "core:slice"
+import "core:sync"
+import "core:thread"
+import "core:time"
+
+import "src:utils"
+
+// Everything that touches the region files goes through the IO thread, so
+// the world thread never waits on the disk. Saves are encoded by whoever
+// queues them and written behind: the IO thread wakes up every
+// WRITE_BEHIND_DELAY, takes everything that piled up and writes it region by
+// region, syncing each region file once per batch. A chunk that gets saved
+// again before it was written only gets written once.
+//
+// Reads don't wait for the IO thread, but they check the queued saves first
+// so a chunk that was unloaded and comes right back isn't read stale.
+
+WRITE_BEHIND_DELAY :: 250 * time.Millisecond
+
+// How often modified chunks that are still loaded get saved.
+AUTOSAVE_INTERVAL :: 30 * time.Second
+
+ChunkIOStats::struct {
+    queued_writes: int,
+    bytes_per_second: int,
+    bytes_written: int,
+}
+
+@(private="file") _io_thread : ^thread.Thread
+@(private="file") _io_running := false
+@(private="file") _io_futex := sync.Futex(0)
+
+// Encoded chunks waiting to be written, and the batch being written right
+// now. Both are only touched with `_io_lock` held.
+@(private="file") _pending_writes : map[ChunkPos][]u8
+@(private="file") _writes_in_flight : map[ChunkPos][]u8
+@(private="file") _prefetch_requests : [dynamic]RegionPos
+@(private="file") _close_regions_around : Maybe(ChunkPos) // only the latest center matters
+@(private="file") _io_lock : sync.Mutex
+
+@(private="file") _bytes_written := 0
+@(private="file") _bytes_per_second := 0
+
+init_chunk_io::proc() {
+    init_regions()
+    _io_running = true
+    _io_thread = thread.create_and_start(io_loop)
+}
+
+// Writes everything that's still queued before it returns.
+deinit_chunk_io::proc() {
+    sync.atomic_store(&_io_running, false)
+    sync.atomic_store(&_io_futex, 1)
+    sync.futex_signal(&_io_futex)
+    thread.join(_io_thread)
+    thread.destroy(_io_thread)
+
+    delete(_pending_writes)
+    delete(_writes_in_flight)
+    delete(_prefetch_requests)
+    deinit_regions()
+}
+
+// Snapshots the chunk and queues it for saving. Safe to call from any
+// thread, as long as nobody else looks at the chunk meanwhile: it clears
+// `modified`, so it needs the blocks lock held exclusively if the chunk
+// is in the store.
+queue_chunk_save::proc(pos: ChunkPos, blocks: ^BlockStorage) {
+    payload := make([dynamic]u8, 0, 1024)
+    encode_chunk_payload(blocks, &payload)
+    blocks.modified = false
+
+    sync.mutex_lock(&_io_lock)
+    defer sync.mutex_unlock(&_io_lock)
+
+    if old, ok := _pending_writes[pos]; ok do delete(old)
+    _pending_writes[pos] = payload[:]
+}
+
+// Fills `layout` with the saved chunk, queued saves included. Safe to call
+// from any thread.
+read_chunk::proc(pos: ChunkPos, layout: ^ChunkLayout) -> (ok: bool) {
+    sync.mutex_lock(&_io_lock)
+    payload, queued := _pending_writes[pos]
+    if !queued do payload, queued = _writes_in_flight[pos]
+    if queued {
+        // the payload is freed once it's written, which needs the lock
+        defer sync.mutex_unlock(&_io_lock)
+        return decode_chunk_payload(payload, layout)
+    }
+    sync.mutex_unlock(&_io_lock)
+
+    return load_chunk(pos, layout)
+}
+
+// Called by the world thread when the center moves, warms up the region
+// the player is heading towards.
+prefetch_ahead::proc(from, to: ChunkPos) {
+    step := ChunkPos{
+        clamp(to.x - from.x, -1, 1),
+        clamp(to.y - from.y, -1, 1),
+        clamp(to.z - from.z, -1, 1),
+    }
+    if step == {} do return
+
+    @(static) last_prefetched : RegionPos
+    @(static) prefetched_once := false
+
+    region, _ := chunk_to_region(to + step * (RENDER_DISTANCE + 1))
+    if prefetched_once && region == last_prefetched do return
+    last_prefetched, prefetched_once = region, true
+
+    sync.mutex_lock(&_io_lock)
+    append(&_prefetch_requests, region)
+    sync.mutex_unlock(&_io_lock)
+
+    sync.atomic_store(&_io_futex, 1)
+    sync.futex_signal(&_io_futex)
+}
+
+// Called by the world thread when the center moves, the regions out of
+// reach get closed on the next batch.
+close_far_regions_later::proc(center: ChunkPos) {
+    sync.mutex_lock(&_io_lock)
+    _close_regions_around = center
+    sync.mutex_unlock(&_io_lock)
+}
+
+get_chunk_io_stats::proc() -> (stats: ChunkIOStats) {
+    sync.mutex_lock(&_io_lock)
+    stats.queued_writes = len(_pending_writes) + len(_writes_in_flight)
+    sync.mutex_unlock(&_io_lock)
+
+    stats.bytes_per_second = sync.atomic_load(&_bytes_per_second)
+    stats.bytes_written = sync.atomic_load(&_bytes_written)
+    return stats
+}
+
+@(private="file")
+io_loop::proc() {
+    last_autosave := time.tick_now()
+    last_second := time.tick_now()
+    bytes_at_last_second := 0
+
+    for {
+        // only prefetches and shutting down wake us early, saves wait for the batch
+        sync.futex_wait_with_timeout(&_io_futex, 0, WRITE_BEHIND_DELAY)
+        sync.atomic_store(&_io_futex, 0)
+
+        // read before flushing, so everything queued before the stop gets written
+        running := sync.atomic_load(&_io_running)
+
+        prefetch_requested_regions()
+
+        if running && time.tick_since(last_autosave) >= AUTOSAVE_INTERVAL {
+            queue_modified_chunks()
+            last_autosave = time.tick_now()
+        }
+
+        write_pending_chunks()
+        close_requested_regions()
+        free_all(context.temp_allocator)
+
+        if elapsed := time.tick_since(last_second); elapsed >= time.Second {
+            written := sync.atomic_load(&_bytes_written)
+            rate := f64(written - bytes_at_last_second) / time.duration_seconds(elapsed)
+            sync.atomic_store(&_bytes_per_second, int(rate))
+            bytes_at_last_second = written
+            last_second = time.tick_now()
+        }
+
+        if !running do break
+    }
+}
+
+@(private="file")
+close_requested_regions::proc() {
+    sync.mutex_lock(&_io_lock)
+    center, ok := _close_regions_around.?
+    _close_regions_around = nil
+    sync.mutex_unlock(&_io_lock)
+
+    if ok do close_far_regions(center, RENDER_DISTANCE)
+}
+
+@(private="file")
+prefetch_requested_regions::proc() {
+    sync.mutex_lock(&_io_lock)
+    requests := slice.clone(_prefetch_requests[:], context.temp_allocator)
+    clear(&_prefetch_requests)
+    sync.mutex_unlock(&_io_lock)
+
+    for region in requests do prefetch_region(region)
+}
+
+// Saving clears `modified`, which edits set, so each chunk gets saved
+// under the exclusive blocks lock. That needs the read lock let go first.
+@(private="file")
+queue_modified_chunks::proc() {
+    modified := make([dynamic]ChunkPos, context.temp_allocator)
+
+    chunk_store_read_lock(&_chunk_store)
+    it := make_chunk_store_iterator(&_chunk_store)
+    for chunk, pos in iterate_chunks(&it) {
+        chunk_store_lock_blocks(&_chunk_store, pos)
+        if chunk.blocks.modified do append(&modified, pos)
+        chunk_store_unlock_blocks(&_chunk_store, pos)
+    }
+    chunk_store_read_unlock(&_chunk_store)
+
+    for pos in modified {
+        // might be gone or saved on its way out by now
+        chunk := chunk_store_begin_edit(&_chunk_store, pos) or_continue
+        if chunk.blocks.modified do queue_chunk_save(pos, chunk.blocks)
+        chunk_store_end_edit(&_chunk_store, pos)
+    }
+}
+
+@(private="file")
+write_pending_chunks::proc() {
+    PendingWrite :: struct {
+        pos: ChunkPos,
+        region: RegionPos,
+        index: int,
+        payload: []u8,
+    }
+
+    sync.mutex_lock(&_io_lock)
+    _pending_writes, _writes_in_flight = _writes_in_flight, _pending_writes
+    batch := make([dynamic]PendingWrite, 0, len(_writes_in_flight), context.temp_allocator)
+    for pos, payload in _writes_in_flight {
+        region, index := chunk_to_region(pos)
+        append(&batch, PendingWrite{pos, region, index, payload})
+    }
+    sync.mutex_unlock(&_io_lock)
+
+    if len(batch) == 0 do return
+
+    // one region after the other, in header order
+    slice.sort_by(batch[:], proc(a, b: PendingWrite) -> bool {
+        if a.region.x != b.region.x do return a.region.x < b.region.x
+        if a.region.y != b.region.y do return a.region.y < b.region.y
+        if a.region.z != b.region.z do return a.region.z < b.region.z
+        return a.index < b.index
+    })
+
+    for write, i in batch {
+        if write_chunk_payload(write.pos, write.payload) {
+            sync.atomic_add(&_bytes_written, len(write.payload))
+        }
+        if i == len(batch) - 1 || batch[i+1].region != write.region do sync_region(write.region)
+    }
+
+    sync.mutex_lock(&_io_lock)
+    for _, payload in _writes_in_flight do delete(payload)
+    clear(&_writes_in_flight)
+    sync.mutex_unlock(&_io_lock)
+}
@@ -0,0 +1,257 @@
+package engine
+
+import "core:sync"
+import "base:intrinsics"
+
+// Loaded chunks live in a toroidal ring. A chunk at `pos` can only ever sit
+// in the slot at `pos & mask` on every axis, and since the ring is wider than
+// the loaded region no two loaded chunks ever share a slot. Lookups are a
+// masked index and a compare, no hashing and no probing.
+//
+// Slots never move. Point lookups are lock free (every slot is a seqlock),
+// readers that keep using a chunk for a while (the mesher, mostly) take
+// `chunk_store_read_lock` so the chunk can't be recycled under them.
+//
+// Edits only lock the slot they edit (see `chunk_store_begin_edit`), so
+// whoever reads a chunk's block storage also locks its blocks with
+// `chunk_store_lock_blocks` for the duration. Cull masks are read without
+// it, a reader can see a column halfway through an edit, but the edit
+// queues a re-mesh of everything it touched anyway.
+ChunkStore::struct {
+    slots: []ChunkSlot,
+    bits: u32, // log2 of the ring size on each axis
+    mask: i32,
+    count: int,
+
+    write_lock: sync.Mutex,
+    readers: sync.RW_Mutex,
+}
+
+ChunkSlot::struct {
+    sequence: u32, // odd while the slot is being written
+    loaded: b32,
+    pos: ChunkPos,
+    chunk: Chunk,
+    blocks_lock: sync.RW_Mutex, // shared for reading the blocks, exclusive for editing them
+}
+
+// Returned by `chunk_store_peek`, see `chunk_store_still_valid`.
+ChunkTicket::struct {
+    slot: ^ChunkSlot,
+    sequence: u32,
+}
+
+init_chunk_store::proc(store: ^ChunkStore, radius: i32) {
+    // the ring has to be strictly wider than the loaded region
+    bits := u32(1)
+    for (i32(1) << bits) < 2*radius + 2 do bits += 1
+
+    store^ = ChunkStore{
+        slots = make([]ChunkSlot, 1 << (3*bits)),
+        bits = bits,
+        mask = (i32(1) << bits) - 1,
+    }
+}
+
+destroy_chunk_store::proc(store: ^ChunkStore) {
+    delete(store.slots)
+    store.slots = nil
+    store.count = 0
+}
+
+@(private="file")
+chunk_slot_index::#force_inline proc(store: ^ChunkStore, pos: ChunkPos) -> int {
+    return int(pos.x & store.mask) | int(pos.y & store.mask) << store.bits | int(pos.z & store.mask) << (2*store.bits)
+}
+
+// Optimistic lookup. Anything read through `chunk` afterwards is only
+// trustworthy if `chunk_store_still_valid` says so, and the block storage
+// must not be read this way at all: it can be freed under the reader, which
+// may crash before there's a chance to check. Take the read lock for that.
+chunk_store_peek::#force_inline proc(store: ^ChunkStore, pos: ChunkPos) -> (chunk: Chunk, ticket: ChunkTicket, ok: bool) {
+    slot := &store.slots[chunk_slot_index(store, pos)]
+    for {
+        seq := sync.atomic_load_explicit(&slot.sequence, .Acquire)
+        if seq & 1 != 0 {
+            intrinsics.cpu_relax()
+            continue
+        }
+
+        slot_pos := slot.pos
+        loaded := slot.loaded
+        chunk = slot.chunk
+
+        sync.atomic_thread_fence(.Acquire)
+        if sync.atomic_load_explicit(&slot.sequence, .Relaxed) != seq do continue
+
+        ok = bool(loaded) && slot_pos == pos
+        return chunk, ChunkTicket{slot, seq}, ok
+    }
+}
+
+chunk_store_still_valid::#force_inline proc(ticket: ChunkTicket) -> bool {
+    sync.atomic_thread_fence(.Acquire)
+    return sync.atomic_load_explicit(&ticket.slot.sequence, .Relaxed) == ticket.sequence
+}
+
+// The returned chunk is only safe to read while holding `chunk_store_read_lock`.
+chunk_store_get::#force_inline proc(store: ^ChunkStore, pos: ChunkPos) -> (chunk: Chunk, ok: bool) {
+    chunk, _, ok = chunk_store_peek(store, pos)
+    return chunk, ok
+}
+
+chunk_store_has::#force_inline proc(store: ^ChunkStore, pos: ChunkPos) -> bool {
+    _, _, ok := chunk_store_peek(store, pos)
+    return ok
+}
+
+// Keeps chunks from being recycled until the matching unlock.
+chunk_store_read_lock::proc(store: ^ChunkStore) {
+    sync.rw_mutex_shared_lock(&store.readers)
+}
+
+chunk_store_read_unlock::proc(store: ^ChunkStore) {
+    sync.rw_mutex_shared_unlock(&store.readers)
+}
+
+// Keeps the chunk's blocks from being edited until the matching unlock.
+// Needs the read lock, and should be held for as short as possible.
+chunk_store_lock_blocks::#force_inline proc(store: ^ChunkStore, pos: ChunkPos) {
+    sync.rw_mutex_shared_lock(&store.slots[chunk_slot_index(store, pos)].blocks_lock)
+}
+
+chunk_store_unlock_blocks::#force_inline proc(store: ^ChunkStore, pos: ChunkPos) {
+    sync.rw_mutex_shared_unlock(&store.slots[chunk_slot_index(store, pos)].blocks_lock)
+}
+
+@(private="file")
+write_slot::#force_inline proc(slot: ^ChunkSlot, pos: ChunkPos, chunk: Chunk, loaded: b32) {
+    sync.atomic_store_explicit(&slot.sequence, slot.sequence + 1, .Relaxed)
+    sync.atomic_thread_fence(.Release)
+    slot.pos = pos
+    slot.chunk = chunk
+    slot.loaded = loaded
+    sync.atomic_store_explicit(&slot.sequence, slot.sequence + 1, .Release)
+}
+
+ChunkInsertResult::enum {
+    INSERTED,
+    EVICTED,        // a stale chunk from somewhere else had to make room
+    ALREADY_LOADED, // nothing changed, the chunk is still the caller's
+}
+
+// If a stale chunk was still sitting in the slot it gets returned with
+// where it was, it's up to the caller to get rid of it like a removed one.
+// A chunk that's already loaded at `pos` is never replaced, it may hold edits.
+chunk_store_insert::proc(store: ^ChunkStore, pos: ChunkPos, chunk: Chunk) -> (result: ChunkInsertResult, evicted: Chunk, evicted_pos: ChunkPos) {
+    sync.mutex_lock(&store.write_lock)
+    slot := &store.slots[chunk_slot_index(store, pos)]
+    if slot.loaded && slot.pos == pos {
+        sync.mutex_unlock(&store.write_lock)
+        return .ALREADY_LOADED, {}, {}
+    }
+
+    result = .INSERTED
+    if slot.loaded {
+        evicted = slot.chunk
+        evicted_pos = slot.pos
+        result = .EVICTED
+    } else {
+        sync.atomic_add(&store.count, 1)
+    }
+    write_slot(slot, pos, chunk, true)
+    sync.mutex_unlock(&store.write_lock)
+
+    if result == .EVICTED do chunk_store_wait_for_readers(store)
+    return result, evicted, evicted_pos
+}
+
+// The chunk is returned once nobody can be reading it anymore,
+// so it can be released right away.
+chunk_store_remove::proc(store: ^ChunkStore, pos: ChunkPos) -> (chunk: Chunk, ok: bool) {
+    sync.mutex_lock(&store.write_lock)
+    slot := &store.slots[chunk_slot_index(store, pos)]
+    if slot.loaded && slot.pos == pos {
+        chunk = slot.chunk
+        ok = true
+        sync.atomic_sub(&store.count, 1)
+        write_slot(slot, pos, Chunk{}, false)
+    }
+    sync.mutex_unlock(&store.write_lock)
+
+    if ok do chunk_store_wait_for_readers(store)
+    return chunk, ok
+}
+
+// Readers that got the chunk before it was unlinked hold the read lock,
+// so grabbing it exclusively once is enough to know they're all gone.
+@(private="file")
+chunk_store_wait_for_readers::proc(store: ^ChunkStore) {
+    sync.rw_mutex_lock(&store.readers)
+    sync.rw_mutex_unlock(&store.readers)
+}
+
+// Gives exclusive access to a loaded chunk's blocks until the matching
+// `chunk_store_end_edit`. Only readers of this one chunk's blocks wait for
+// it, everything else carries on. Keep it short, and don't call it while
+// holding the read lock yourself.
+chunk_store_begin_edit::proc(store: ^ChunkStore, pos: ChunkPos) -> (chunk: Chunk, ok: bool) {
+    // the read lock keeps the chunk from being recycled while it's edited
+    sync.rw_mutex_shared_lock(&store.readers)
+    slot := &store.slots[chunk_slot_index(store, pos)]
+    sync.rw_mutex_lock(&slot.blocks_lock)
+
+    chunk, ok = chunk_store_get(store, pos)
+    if !ok {
+        sync.rw_mutex_unlock(&slot.blocks_lock)
+        sync.rw_mutex_shared_unlock(&store.readers)
+        return {}, false
+    }
+    return chunk, true
+}
+
+chunk_store_end_edit::proc(store: ^ChunkStore, pos: ChunkPos) {
+    sync.rw_mutex_unlock(&store.slots[chunk_slot_index(store, pos)].blocks_lock)
+    sync.rw_mutex_shared_unlock(&store.readers)
+}
+
+chunk_store_count::proc(store: ^ChunkStore) -> int {
+    return sync.atomic_load(&store.count)
+}
+
+// Walks every loaded chunk, in slot order.
+// Use as `for chunk, pos in iterate_chunks(&it)`.
+ChunkStoreIterator::struct {
+    store: ^ChunkStore,
+    index: int,
+}
+
+make_chunk_store_iterator::proc(store: ^ChunkStore) -> ChunkStoreIterator {
+    return ChunkStoreIterator{store = store}
+}
+
+iterate_chunks::proc(it: ^ChunkStoreIterator) -> (chunk: Chunk, pos: ChunkPos, ok: bool) {
+    for it.index < len(it.store.slots) {
+        slot := &it.store.slots[it.index]
+        it.index += 1
+        if !sync.atomic_load_explicit(&slot.loaded, .Relaxed) do continue
+
+        pos = slot.pos
+        chunk, _, ok = chunk_store_peek(it.store, pos)
+        if ok do return chunk, pos, true
+    }
+    return {}, {}, false
+}
+
+// Calls `f` for every loaded chunk within `radius` of `center`.
+for_each_chunk_in_region::proc(store: ^ChunkStore, center: ChunkPos, radius: i32, curry: $C, f: proc(pos: ChunkPos, chunk: Chunk, curry: C)) {
+    for z := center.z - radius; z <= center.z + radius; z += 1 {
+        for y := center.y - radius; y <= center.y + radius; y += 1 {
+            for x := center.x - radius; x <= center.x + radius; x += 1 {
+                pos := ChunkPos{x, y, z}
+                chunk, ok := chunk_store_get(store, pos)
+                if ok do f(pos, chunk, curry)
+            }
+        }
+    }
+}
@@ -0,0 +1,139 @@
+package engine
+
+import "core:log"
+import "core:math"
+import "core:math/linalg"
+import "core:testing"
+import "core:time"
+
+import "src:utils"
+
+// Culls a grid of chunks against a fixed camera and checks every chunk
+// against its 8 corners put through the matrix directly. Needs neither GL
+// nor a loaded world.
+
+@(private="file") CULL_RADIUS :: 6
+@(private="file") CULL_SIDE :: 2*CULL_RADIUS + 1
+@(private="file") CULL_COUNT :: CULL_SIDE*CULL_SIDE*CULL_SIDE
+
+@(test)
+test_cpu_culling_matches_reference::proc(t: ^testing.T) {
+    positions, commands := make_cull_grid()
+    defer delete(positions)
+    defer delete(commands)
+    mvp := cull_test_camera()
+    frustum := frustum_from_matrix(mvp)
+
+    culled : [dynamic]IndirectCommand
+    defer delete(culled)
+    changed : [dynamic]DirtyRange
+    defer delete(changed)
+    stats := cull_chunks(&frustum, positions, commands, &culled, &changed)
+    testing.expect_value(t, len(culled), len(commands))
+
+    visible_count := 0
+    for cmd, i in commands {
+        visible := culled[i].instance_count != 0
+        if visible do visible_count += 1
+
+        if cmd.instance_count == 0 {
+            testing.expectf(t, !visible, "chunk %v has no mesh but draws something", positions[i])
+            continue
+        }
+        want, sure := reference_chunk_visible(mvp, positions[i])
+        if sure do testing.expectf(t, visible == want, "chunk %v is visible: %v, should be %v", positions[i], visible, want)
+        // everything but the instance count stays, so draws keep lining up with the positions
+        if visible {
+            testing.expectf(t, culled[i] == cmd, "visible chunk %v got its command changed", positions[i])
+        } else {
+            testing.expectf(t, culled[i].base_instance == cmd.base_instance, "culled chunk %v got its command moved", positions[i])
+        }
+    }
+    testing.expect(t, visible_count > 0 && visible_count < CULL_COUNT, "the camera sees all or nothing")
+    testing.expect_value(t, stats.chunks_visible, visible_count)
+
+    // nothing moved, so nothing needs uploading
+    clear(&changed)
+    cull_chunks(&frustum, positions, commands, &culled, &changed)
+    testing.expectf(t, len(changed) == 0, "the same frustum changed %d command ranges", len(changed))
+}
+
+when utils.ENABLE_BENCHMARKS {
+
+    @(test)
+    bench_cpu_culling::proc(t: ^testing.T) {
+        ITERATIONS :: 256
+
+        positions, commands := make_cull_grid()
+        defer delete(positions)
+        defer delete(commands)
+        frustum := frustum_from_matrix(cull_test_camera())
+
+        culled : [dynamic]IndirectCommand
+        defer delete(culled)
+        changed : [dynamic]DirtyRange
+        defer delete(changed)
+
+        stats : CullStats
+        start := time.tick_now()
+        for _ in 0..<ITERATIONS {
+            clear(&changed)
+            stats = cull_chunks(&frustum, positions, commands, &culled, &changed)
+        }
+        seconds := time.duration_seconds(time.tick_since(start))
+
+        log.infof("culling: %d of %d chunks visible, %.0f chunks/sec",
+            stats.chunks_visible, stats.chunks_total, f64(ITERATIONS * CULL_COUNT) / seconds)
+    }
+
+}
+
+@(private="file")
+make_cull_grid::proc() -> (positions: [][4]i32, commands: []IndirectCommand) {
+    positions = make([][4]i32, CULL_COUNT)
+    commands = make([]IndirectCommand, CULL_COUNT)
+    for &pos, i in positions {
+        pos = {i32(i % CULL_SIDE) - CULL_RADIUS, i32(i / CULL_SIDE % CULL_SIDE) - CULL_RADIUS, i32(i / (CULL_SIDE*CULL_SIDE)) - CULL_RADIUS, 0}
+        // every 7th chunk has no mesh, those never draw anything
+        commands[i] = IndirectCommand{count = 4, instance_count = i % 7 == 0 ? 0 : u32(1 + i % 5), base_instance = u32(i)}
+    }
+    return positions, commands
+}
+
+// Off the grid and at an angle, so no plane runs along a chunk's side.
+@(private="file")
+cull_test_camera::proc() -> linalg.Matrix4f32 {
+    eye := [3]f32{0.5, 7.25, -3.75}
+    view := linalg.matrix4_look_at_f32(eye, eye + {1, 0.2, 0.1}, {0, 1, 0})
+    proj := linalg.matrix4_perspective_f32(math.PI / 2, 16.0 / 9.0, 0.1, 64)
+    return proj * view
+}
+
+// A chunk is out when all its corners are on the wrong side of the same
+// clip plane, which is what the plane test boils down to. Not `sure`
+// when a corner is too close to a plane to tell.
+@(private="file")
+reference_chunk_visible::proc(mvp: linalg.Matrix4f32, pos: [4]i32) -> (visible, sure: bool) {
+    EPSILON :: 1e-2
+
+    // how far the furthest corner gets inside each plane
+    inside := [6]f32{min(f32), min(f32), min(f32), min(f32), min(f32), min(f32)}
+    for corner in 0..<8 {
+        p := linalg.Vector4f32{
+            f32(pos.x*16 + i32(corner & 1)*16),
+            f32(pos.y*16 + i32((corner >> 1) & 1)*16),
+            f32(pos.z*16 + i32(corner >> 2)*16),
+            1,
+        }
+        c := mvp * p
+        distances := [6]f32{c.w + c.x, c.w - c.x, c.w + c.y, c.w - c.y, c.w + c.z, c.w - c.z}
+        for d, k in distances do inside[k] = max(inside[k], d)
+    }
+
+    sure = true
+    for d in inside {
+        if d < -EPSILON do return false, true
+        if d <= EPSILON do sure = false
+    }
+    return true, sure
+}
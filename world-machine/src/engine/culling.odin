@@ -0,0 +1,94 @@
+package engine
+
+import "core:math/linalg"
+
+// Planes are stored as (normal, distance), pointing into the frustum.
+Frustum::[6][4]f32
+
+CullingMode::enum {
+    NONE,
+    CPU,
+    GPU, // falls back to CPU if compute shaders aren't available
+}
+
+CULLING_MODE := CullingMode.CPU
+
+CullStats::struct {
+    chunks_total, chunks_visible: int,
+    instances_total, instances_visible: int,
+}
+
+// Gribb & Hartmann, pulls the clip planes straight out of a view-projection matrix.
+frustum_from_matrix::proc(m: linalg.Matrix4f32) -> (frustum: Frustum) {
+    row :: #force_inline proc(m: linalg.Matrix4f32, i: int) -> [4]f32 {
+        return {m[i, 0], m[i, 1], m[i, 2], m[i, 3]}
+    }
+    r0, r1, r2, r3 := row(m, 0), row(m, 1), row(m, 2), row(m, 3)
+
+    frustum = {
+        r3 + r0, r3 - r0, // left, right
+        r3 + r1, r3 - r1, // bottom, top
+        r3 + r2, r3 - r2, // near, far
+    }
+    for &plane in frustum {
+        plane /= linalg.length(plane.xyz)
+    }
+    return frustum
+}
+
+// Only checks the corner furthest along each plane's normal, which is
+// enough to tell if a box is fully outside.
+aabb_in_frustum::#force_inline proc(frustum: ^Frustum, lo, hi: [3]f32) -> bool {
+    for plane in frustum^ {
+        corner := [3]f32{
+            plane.x >= 0 ? hi.x : lo.x,
+            plane.y >= 0 ? hi.y : lo.y,
+            plane.z >= 0 ? hi.z : lo.z,
+        }
+        if linalg.dot(plane.xyz, corner) + plane.w < 0 do return false
+    }
+    return true
+}
+
+// Writes every chunk's command to `out`, with the ones outside the frustum
+// drawing no instances. That way the draws still line up with the chunk
+// positions (the shader indexes those with gl_DrawID), and only the commands
+// that changed since the last call go into `changed` to be uploaded, mostly
+// the ones whose chunk came into or went out of view. Doesn't touch GL at all.
+cull_chunks::proc(
+    frustum: ^Frustum,
+    positions: [][4]i32,
+    commands: []IndirectCommand,
+    out: ^[dynamic]IndirectCommand,
+    changed: ^[dynamic]DirtyRange,
+) -> (stats: CullStats) {
+    assert(len(positions) == len(commands))
+    old_len := len(out)
+    resize(out, len(commands))
+
+    for cmd, i in commands {
+        culled := cmd
+        if cmd.instance_count != 0 {
+            stats.chunks_total += 1
+            stats.instances_total += int(cmd.instance_count)
+
+            pos := positions[i]
+            lo := [3]f32{f32(pos.x), f32(pos.y), f32(pos.z)} * 16
+            if aabb_in_frustum(frustum, lo, lo + 16) {
+                stats.chunks_visible += 1
+                stats.instances_visible += int(cmd.instance_count)
+            } else {
+                culled.instance_count = 0
+            }
+        }
+
+        if i < old_len && out[i] == culled do continue
+        out[i] = culled
+        if n := len(changed); n > 0 && changed[n-1].end == i {
+            changed[n-1].end = i + 1
+        } else {
+            append(changed, DirtyRange{i, i + 1})
+        }
+    }
+    return stats
+}
@@ -0,0 +1,189 @@
+package engine
+
+import "core:math/rand"
+import "core:testing"
+
+@(private="file")
+TestPattern::enum {
+    AIR,
+    FULL,
+    FULL_MIXED, // full, but every block picks one of a few ids
+    CHECKERBOARD,
+    SINGLE_VOXEL,
+    CORNER_VOXEL,
+    STRIPES,
+    SPARSE,
+    DENSE,
+    BOXES,
+}
+
+@(private="file")
+FACE_NORMALS := [BlockFaces][3]int{
+    .NORTH  = {1, 0, 0},
+    .EAST   = {-1, 0, 0},
+    .SOUTH  = {0, 0, 1},
+    .WEST   = {0, 0, -1},
+    .TOP    = {0, 1, 0},
+    .BOTTOM = {0, -1, 0},
+}
+
+// Meshes made-up chunks in every mode, with no neighbours, and checks the
+// quads against a brute-force walk over the blocks. Most patterns are
+// random, so each runs a few times.
+@(test)
+test_meshes_match_reference::proc(t: ^testing.T) {
+    ROUNDS :: 8
+
+    // stays empty, so every neighbour is air
+    store : ChunkStore
+    init_chunk_store(&store, 1)
+    defer destroy_chunk_store(&store)
+
+    out := make([]BlockVertData, MAX_CHUNK_MESH_SIZE)
+    defer delete(out)
+    blocks := new(ChunkBlocks)
+    defer free(blocks)
+    expected := new([BlockFaces]ChunkBlocks)
+    defer free(expected)
+    covered := new([BlockFaces]ChunkBlocks)
+    defer free(covered)
+
+    for pattern in TestPattern {
+        for _ in 0..<ROUNDS {
+            fill_pattern(pattern, blocks)
+
+            mask : ChunkBitMask
+            build_cull_mask(blocks[:], &mask)
+            padded : PaddedBitMask
+            build_padded_mask(&store, {}, &mask, &padded)
+            faces := reference_faces(blocks, expected)
+
+            quads : [MeshingMode]u32
+            for mode in MeshingMode {
+                quads[mode] = mesh_blocks(&padded, blocks, out, mode)
+                testing.expectf(t, quads_cover_faces(out[:quads[mode]], expected, covered),
+                    "%v mesh of a %v chunk doesn't cover exactly the visible faces", mode, pattern)
+            }
+
+            testing.expectf(t, int(quads[.PER_FACE]) == faces, "%v chunk: %d per-face quads for %d faces", pattern, quads[.PER_FACE], faces)
+            testing.expectf(t, quads[.GREEDY] <= quads[.PER_FACE], "%v chunk: %d greedy quads, more than the %d per-face ones", pattern, quads[.GREEDY], quads[.PER_FACE])
+
+            #partial switch pattern {
+            case .FULL:
+                testing.expectf(t, quads[.GREEDY] == 6, "a full chunk took %d greedy quads instead of 6", quads[.GREEDY])
+            case .CHECKERBOARD:
+                // no two faces of a slice touch, there's nothing to merge
+                testing.expectf(t, quads[.GREEDY] == quads[.PER_FACE], "a checkerboard took %d greedy quads, not %d", quads[.GREEDY], quads[.PER_FACE])
+            }
+        }
+    }
+}
+
+@(private="file")
+fill_pattern::proc(pattern: TestPattern, blocks: ^ChunkBlocks) {
+    blocks^ = {}
+
+    switch pattern {
+    case .AIR:
+    case .FULL:
+        for &id in blocks do id = 1
+    case .FULL_MIXED:
+        for &id in blocks do id = BlockID(1 + rand.int_max(3))
+    case .CHECKERBOARD:
+        for z in 0..<CS {
+            for x in 0..<CS {
+                for y in 0..<CS {
+                    if (x + y + z) % 2 == 0 do blocks[chunk_block_index(x, y, z)] = 1
+                }
+            }
+        }
+    case .SINGLE_VOXEL:
+        blocks[rand.int_max(len(blocks))] = BlockID(1 + rand.int_max(1000))
+    case .CORNER_VOXEL:
+        c := [2]int{0, CS - 1}
+        blocks[chunk_block_index(c[rand.int_max(2)], c[rand.int_max(2)], c[rand.int_max(2)])] = 2
+    case .STRIPES:
+        for z in 0..<CS {
+            for x in 0..<CS {
+                for y in 0..<CS {
+                    if x % 2 == 0 do blocks[chunk_block_index(x, y, z)] = BlockID(1 + z % 2)
+                }
+            }
+        }
+    case .SPARSE:
+        for &id in blocks do if rand.int_max(20) == 0 do id = BlockID(1 + rand.int_max(4))
+    case .DENSE:
+        for &id in blocks do if rand.int_max(5) != 0 do id = BlockID(1 + rand.int_max(2))
+    case .BOXES:
+        for _ in 0..<1 + rand.int_max(6) {
+            lo := [3]int{rand.int_max(CS), rand.int_max(CS), rand.int_max(CS)}
+            hi := [3]int{lo.x + rand.int_max(CS - lo.x), lo.y + rand.int_max(CS - lo.y), lo.z + rand.int_max(CS - lo.z)}
+            id := BlockID(rand.int_max(4)) // air carves holes
+            for z in lo.z..=hi.z {
+                for x in lo.x..=hi.x {
+                    for y in lo.y..=hi.y {
+                        blocks[chunk_block_index(x, y, z)] = id
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The id of every block face with air (or the chunk's edge) in front of it,
+// 0 where there's no face. Returns how many faces there are.
+@(private="file")
+reference_faces::proc(blocks: ^ChunkBlocks, out: ^[BlockFaces]ChunkBlocks) -> (count: int) {
+    out^ = {}
+    for z in 0..<CS {
+        for x in 0..<CS {
+            for y in 0..<CS {
+                id := blocks[chunk_block_index(x, y, z)]
+                if id == 0 do continue
+
+                for face in BlockFaces {
+                    n := [3]int{x, y, z} + FACE_NORMALS[face]
+                    inside := n.x >= 0 && n.x < CS && n.y >= 0 && n.y < CS && n.z >= 0 && n.z < CS
+                    if inside && blocks[chunk_block_index(n.x, n.y, n.z)] != 0 do continue
+
+                    out[face][chunk_block_index(x, y, z)] = id
+                    count += 1
+                }
+            }
+        }
+    }
+    return count
+}
+
+// Unpacks what `create_mesh_data` packed and marks every face the quads
+// cover, failing on overlaps and on faces that shouldn't be there.
+@(private="file")
+quads_cover_faces::proc(quads: []BlockVertData, expected, covered: ^[BlockFaces]ChunkBlocks) -> bool {
+    covered^ = {}
+
+    for quad in quads {
+        p := [3]int{int(quad & 31), int((quad >> 5) & 31), int((quad >> 10) & 31)}
+        width, height := int((quad >> 15) & 31), int((quad >> 20) & 31)
+        face := BlockFaces((quad >> 25) & 7)
+        texture := BlockID((quad >> 32) & 0xffff) + BlockID((quad >> 48) & 0xffff) * TILES_PER_ROW
+
+        axes := FACE_AXES[face]
+        if axes.positive do p[axes.normal] -= 1
+
+        for dv in 0..<height {
+            for du in 0..<width {
+                b := p
+                b[axes.u] += du
+                b[axes.v] += dv
+                if b.x < 0 || b.x >= CS || b.y < 0 || b.y >= CS || b.z < 0 || b.z >= CS do return false
+
+                i := chunk_block_index(b.x, b.y, b.z)
+                if expected[face][i] != texture || covered[face][i] != 0 do return false
+                covered[face][i] = texture
+            }
+        }
+    }
+
+    // and nothing got left out
+    return covered^ == expected^
+}
@@ -0,0 +1,284 @@
+package engine
+
+import "core:math/bits"
+import "core:thread"
+
+import "src:utils"
+
+CS :: 16 // chunk size
+CS_2 :: CS * CS // squared
+
+MeshingMode::enum {
+    GREEDY,   // merges faces of the same block into as few quads as possible
+    PER_FACE, // one quad per visible face, much cheaper to build
+}
+
+MESHING_MODE := MeshingMode.GREEDY
+
+BlockVertData::u64
+
+PADDED_CS :: CS + 2
+
+// The chunk's occupancy with a one block border taken from its neighbours,
+// indexed (x+1) + (z+1)*18 with bit y+1 for block y. Missing neighbours
+// count as air.
+PaddedBitMask::[PADDED_CS*PADDED_CS]u32
+
+// Block ids of a whole chunk, laid out like the chunk (see `chunk_block_index`).
+ChunkBlocks::[CS*CS*CS]BlockID
+
+// Which axis a face points along, the two axes its quads span and
+// whether it looks towards the positive end of its axis.
+// The shader has the same table, keep them in sync.
+@(private)
+FaceAxes::struct {
+    normal, u, v: int,
+    positive: bool,
+}
+
+@(private)
+FACE_AXES := [BlockFaces]FaceAxes{
+    .NORTH  = {normal = 0, u = 2, v = 1, positive = true},
+    .SOUTH  = {normal = 2, u = 0, v = 1, positive = true},
+    .EAST   = {normal = 0, u = 2, v = 1, positive = false},
+    .WEST   = {normal = 2, u = 0, v = 1, positive = false},
+    .TOP    = {normal = 1, u = 0, v = 2, positive = true},
+    .BOTTOM = {normal = 1, u = 0, v = 2, positive = false},
+}
+
+create_mesh_data::#force_inline proc(
+    #any_int pos_x, pos_y, pos_z: int,
+    #any_int size_u, size_v: int,
+    #any_int face: int,
+    #any_int texture: int
+) -> BlockVertData {
+    tex_u, tex_v := texture % TILES_PER_ROW, texture / TILES_PER_ROW
+    return BlockVertData(
+        (u64(pos_x) << 0) | (u64(pos_y) << 5) | (u64(pos_z) << 10) | // 5 bits each
+        (u64(size_u) << 15) | (u64(size_v) << 20) | // 5 bits each
+        (u64(face) << 25) | // 3 bits
+        (u64(tex_u) << 32) | (u64(tex_v) << 48) // 16 bits each
+    )
+    // here's a visualized memory layout
+    // XXXXXYYY YYZZZZZU UUUUVVVV VFFF----
+    // UUUUUUUU UUUUUUUU VVVVVVVV VVVVVVVV
+}
+
+// Enough room for every face of every block, meshes never get bigger than this.
+MAX_CHUNK_MESH_SIZE :: 6*CS*CS*CS
+
+// A mesh built on a job thread, waiting for the main thread to pick it up.
+ChunkMesh::struct {
+    pos: ChunkPos,
+    generation: u32, // the mesh is stale if the chunk was queued again since
+    mode: MeshingMode,
+    data: [dynamic]BlockVertData,
+}
+
+// Finished meshes. It never holds more meshes than the renderer lets be
+// in flight, so enqueueing can't fail.
+@(private)
+_meshes_ready : utils.MPMCQueue(^ChunkMesh)
+
+@(private)
+_mesh_group : utils.JobGroup
+
+// Runs on the job threads. The mesh comes with its position, generation
+// and mode filled in, and goes back through `_meshes_ready`.
+mesh_chunk_job::proc(payload: ^^ChunkMesh) {
+    mesh := payload^
+
+    // given back when the job returns, see `run_job`
+    scratch := make([]BlockVertData, MAX_CHUNK_MESH_SIZE, context.temp_allocator)
+    size := calculate_chunk_data(mesh.pos, scratch, mesh.mode)
+
+    // meshes get recycled, so without the shrink each one would keep
+    // the memory of the biggest chunk it ever held
+    resize(&mesh.data, int(size))
+    shrink(&mesh.data)
+    copy(mesh.data[:], scratch[:size])
+
+    for !utils.enqueue(&_meshes_ready, mesh) do thread.yield()
+}
+
+// Returns how many quads were written to `out`, 0 if the chunk isn't loaded.
+calculate_chunk_data::proc(pos: ChunkPos, out: []BlockVertData, mode := MESHING_MODE) -> (size: u32) {
+    assert(len(out) >= MAX_CHUNK_MESH_SIZE)
+
+    // the chunk can't be recycled while we're reading it
+    chunk_store_read_lock(&_chunk_store)
+    defer chunk_store_read_unlock(&_chunk_store)
+
+    chunk, has := chunk_store_get(&_chunk_store, pos)
+    if !has do return 0
+
+    padded : PaddedBitMask
+    build_padded_mask(&_chunk_store, pos, chunk.cull_mask, &padded)
+
+    blocks : ChunkBlocks
+    chunk_store_lock_blocks(&_chunk_store, pos)
+    block_storage_decode(chunk.blocks, blocks[:])
+    chunk_store_unlock_blocks(&_chunk_store, pos)
+
+    return mesh_blocks(&padded, &blocks, out, mode)
+}
+
+// The part of meshing that doesn't need the world, see `calculate_chunk_data`.
+mesh_blocks::proc(padded: ^PaddedBitMask, blocks: ^ChunkBlocks, out: []BlockVertData, mode: MeshingMode) -> (size: u32) {
+    face_masks : [BlockFaces]ChunkBitMask
+    build_face_masks(padded, &face_masks)
+
+    for face in BlockFaces {
+        switch mode {
+        case .GREEDY:   mesh_face_greedy(face, &face_masks[face], blocks, out, &size)
+        case .PER_FACE: mesh_face_per_block(face, &face_masks[face], blocks, out, &size)
+        }
+    }
+    return size
+}
+
+// Needs the chunk store read lock, since it reads the neighbours' masks.
+build_padded_mask::proc(store: ^ChunkStore, pos: ChunkPos, mask: ^ChunkBitMask, out: ^PaddedBitMask) {
+    out^ = {}
+
+    for z in 0..<CS {
+        for x in 0..<CS {
+            out[(x+1) + (z+1)*PADDED_CS] = u32(mask[x + z*CS]) << 1
+        }
+    }
+
+    if above, ok := chunk_store_get(store, pos + ChunkPos{0, 1, 0}); ok {
+        for z in 0..<CS {
+            for x in 0..<CS do out[(x+1) + (z+1)*PADDED_CS] |= (u32(above.cull_mask[x + z*CS]) & 1) << (CS+1)
+        }
+    }
+    if below, ok := chunk_store_get(store, pos - ChunkPos{0, 1, 0}); ok {
+        for z in 0..<CS {
+            for x in 0..<CS do out[(x+1) + (z+1)*PADDED_CS] |= u32(below.cull_mask[x + z*CS]) >> (CS-1)
+        }
+    }
+
+    // the sides only need the neighbours' facing column
+    if plus_x, ok := chunk_store_get(store, pos + ChunkPos{1, 0, 0}); ok {
+        for z in 0..<CS do out[(CS+1) + (z+1)*PADDED_CS] = u32(plus_x.cull_mask[0 + z*CS]) << 1
+    }
+    if minus_x, ok := chunk_store_get(store, pos - ChunkPos{1, 0, 0}); ok {
+        for z in 0..<CS do out[0 + (z+1)*PADDED_CS] = u32(minus_x.cull_mask[(CS-1) + z*CS]) << 1
+    }
+    if plus_z, ok := chunk_store_get(store, pos + ChunkPos{0, 0, 1}); ok {
+        for x in 0..<CS do out[(x+1) + (CS+1)*PADDED_CS] = u32(plus_z.cull_mask[x + 0*CS]) << 1
+    }
+    if minus_z, ok := chunk_store_get(store, pos - ChunkPos{0, 0, 1}); ok {
+        for x in 0..<CS do out[(x+1) + 0*PADDED_CS] = u32(minus_z.cull_mask[x + (CS-1)*CS]) << 1
+    }
+}
+
+// Every visible face of every block, one mask per face direction, laid out
+// like the cull mask (x + z*16, a bit per y).
+build_face_masks::proc(padded: ^PaddedBitMask, out: ^[BlockFaces]ChunkBitMask) {
+    for z in 0..<CS {
+        for x in 0..<CS {
+            i := x + z*CS
+            p := (x+1) + (z+1)*PADDED_CS
+            column := padded[p]
+
+            out[.NORTH][i]  = u16((column & ~padded[p + 1]) >> 1)
+            out[.EAST][i]   = u16((column & ~padded[p - 1]) >> 1)
+            out[.SOUTH][i]  = u16((column & ~padded[p + PADDED_CS]) >> 1)
+            out[.WEST][i]   = u16((column & ~padded[p - PADDED_CS]) >> 1)
+            out[.TOP][i]    = u16((column & ~(column >> 1)) >> 1)
+            out[.BOTTOM][i] = u16((column & ~(column << 1)) >> 1)
+        }
+    }
+}
+
+// Goes through the chunk one slice at a time along the face's normal and
+// grows every quad as wide as it can, then as tall as it can.
+mesh_face_greedy::proc(face: BlockFaces, mask: ^ChunkBitMask, blocks: ^ChunkBlocks, out: []BlockVertData, size: ^u32) {
+    axes := FACE_AXES[face]
+
+    for depth in 0..<CS {
+        // block ids of the visible faces in this slice, 0 where there's none
+        slice : [CS_2]BlockID
+        has_faces := false
+
+        for v in 0..<CS {
+            for u in 0..<CS {
+                p : [3]int
+                p[axes.normal], p[axes.u], p[axes.v] = depth, u, v
+                if (mask[p.x + p.z*CS] >> uint(p.y)) & 1 == 0 do continue
+
+                slice[u + v*CS] = blocks[chunk_block_index(p.x, p.y, p.z)]
+                has_faces = true
+            }
+        }
+        if !has_faces do continue
+
+        for v in 0..<CS {
+            for u := 0; u < CS; {
+                id := slice[u + v*CS]
+                if id == 0 {
+                    u += 1
+                    continue
+                }
+
+                width := 1
+                for u + width < CS && slice[u + width + v*CS] == id do width += 1
+
+                height := 1
+                grow: for v + height < CS {
+                    for k in 0..<width {
+                        if slice[u + k + (v + height)*CS] != id do break grow
+                    }
+                    height += 1
+                }
+
+                for dv in 0..<height {
+                    for k in 0..<width do slice[u + k + (v + dv)*CS] = 0
+                }
+
+                emit_quad(face, depth, u, v, width, height, id, out, size)
+                u += width
+            }
+        }
+    }
+}
+
+// No merging at all, just walks the set bits of the face mask.
+mesh_face_per_block::proc(face: BlockFaces, mask: ^ChunkBitMask, blocks: ^ChunkBlocks, out: []BlockVertData, size: ^u32) {
+    axes := FACE_AXES[face]
+
+    for i in 0..<CS_2 {
+        column := mask[i]
+        x, z := i & (CS-1), i / CS
+
+        for column != 0 {
+            y := int(bits.trailing_zeros(column))
+            column &= column - 1
+
+            p := [3]int{x, y, z}
+            emit_quad(face, p[axes.normal], p[axes.u], p[axes.v], 1, 1, blocks[chunk_block_index(x, y, z)], out, size)
+        }
+    }
+}
+
+@(private="file")
+emit_quad::#force_inline proc(face: BlockFaces, depth, u, v, width, height: int, id: BlockID, out: []BlockVertData, size: ^u32) {
+    axes := FACE_AXES[face]
+
+    // faces looking towards +axis sit on the far side of their block
+    p : [3]int
+    p[axes.normal] = depth + (axes.positive ? 1 : 0)
+    p[axes.u], p[axes.v] = u, v
+
+    out[size^] = create_mesh_data(
+        pos_x   = p.x,
+        pos_y   = p.y,
+        pos_z   = p.z,
+        size_u  = width,
+        size_v  = height,
+        face    = int(face),
+        texture = id,
+    )
+    size^ += 1
+}
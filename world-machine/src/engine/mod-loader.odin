@@ -60,6 +60,15 @@ init_mod_functions::proc() {
     api := ApiFunctions{
         // add_block = add_block,
         // add_entity = add_entity,
+        get_block = api_get_block,
+        change_block = api_change_block,
+        fill_blocks = api_fill_blocks,
+        replace_blocks = api_replace_blocks,
+        copy_blocks = api_copy_blocks,
+        free_copied_blocks = api_free_copied_blocks,
+        paste_blocks = api_paste_blocks,
+        register_tickable_block = api_register_tickable_block,
+        schedule_block_tick = api_schedule_block_tick,
     }
 
     for &mod in m_mod_list {
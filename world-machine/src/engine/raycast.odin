@@ -0,0 +1,217 @@
+package engine
+
+import "core:math"
+import "core:math/linalg"
+import "core:math/rand"
+import "core:time"
+
+import "src:utils"
+
+// Amanatides & Woo, steps through the blocks a ray passes through one face
+// at a time. Empty space is skipped using the cull masks: a chunk that isn't
+// loaded or has nothing in it is crossed in one go, and so is a 16 block
+// column of a chunk with nothing in it.
+
+Ray::struct {
+    origin: Position,
+    dir: [3]f64, // doesn't have to be normalized
+    max_distance: f64,
+}
+
+RayHit::struct {
+    target: RayTarget,
+    distance: f64,
+    hit: bool,
+}
+
+// How many rays of a batch one job handles.
+RAYS_PER_JOB :: 64
+
+raycast::proc(origin: Position, dir: [3]f64, max_distance: f64) -> (target: RayTarget, distance: f64, hit: bool) {
+    chunk_store_read_lock(&_chunk_store)
+    defer chunk_store_read_unlock(&_chunk_store)
+    return raycast_locked(origin, dir, max_distance)
+}
+
+// For lots of rays at once, line of sight checks mostly. The rays are
+// split between the job threads and `out` needs room for every one.
+raycast_batch::proc(rays: []Ray, out: []RayHit) {
+    assert(len(out) >= len(rays))
+
+    RaycastJob :: struct {
+        rays: []Ray,
+        out: [^]RayHit,
+    }
+    job_proc :: proc(job: ^RaycastJob) {
+        chunk_store_read_lock(&_chunk_store)
+        defer chunk_store_read_unlock(&_chunk_store)
+
+        for ray, i in job.rays {
+            hit := &job.out[i]
+            hit.target, hit.distance, hit.hit = raycast_locked(ray.origin, ray.dir, ray.max_distance)
+        }
+    }
+
+    group : utils.JobGroup
+    jobs := make([dynamic]utils.Job, 0, (len(rays) + RAYS_PER_JOB - 1) / RAYS_PER_JOB)
+    defer delete(jobs)
+
+    for start := 0; start < len(rays); start += RAYS_PER_JOB {
+        end := min(start + RAYS_PER_JOB, len(rays))
+        append(&jobs, utils.make_job(job_proc, RaycastJob{rays[start:end], &out[start]}, &group))
+    }
+    utils.submit_batch(&_jobs, jobs[:])
+    utils.wait_for_group(&_jobs, &group)
+}
+
+// Needs the chunk store read lock.
+@(private="file")
+raycast_locked::proc(origin: Position, dir: [3]f64, max_distance: f64) -> (target: RayTarget, distance: f64, hit: bool) {
+    dir := linalg.normalize0(dir)
+    if dir == {} do return
+
+    step : [3]i32
+    inv : [3]f64
+    for i in 0..<3 {
+        step[i] = dir[i] > 0 ? 1 : (dir[i] < 0 ? -1 : 0)
+        inv[i] = dir[i] != 0 ? 1 / dir[i] : math.inf_f64(1)
+    }
+
+    voxel := BlockPos{i32(math.floor(origin.x)), i32(math.floor(origin.y)), i32(math.floor(origin.z))}
+    t := 0.0
+    axis := -1 // the axis of the last face the ray went through
+
+    chunk_pos : ChunkPos
+    chunk : Chunk
+    chunk_empty := true
+    have_chunk := false
+
+    for {
+        // distance to the next face on each axis
+        t_max : [3]f64
+        for i in 0..<3 {
+            switch {
+            case step[i] > 0: t_max[i] = (f64(voxel[i]) + 1 - origin[i]) * inv[i]
+            case step[i] < 0: t_max[i] = (f64(voxel[i]) - origin[i]) * inv[i]
+            case:             t_max[i] = math.inf_f64(1)
+            }
+        }
+
+        // stepped through block by block until there's empty space to skip
+        skip : BlockBox
+        for {
+            pos, local := world_to_chunk_space(voxel)
+            if !have_chunk || pos != chunk_pos {
+                ok : bool
+                chunk, ok = chunk_store_get(&_chunk_store, pos)
+                chunk_pos, have_chunk = pos, true
+                chunk_empty = !ok || cull_mask_is_empty(chunk.cull_mask)
+            }
+
+            if chunk_empty {
+                skip = {pos * 16, pos * 16 + 15}
+                break
+            }
+
+            column := chunk.cull_mask[int(local.x) + int(local.z)*16]
+            if column == 0 {
+                skip = {{voxel.x, pos.y * 16, voxel.z}, {voxel.x, pos.y * 16 + 15, voxel.z}}
+                break
+            }
+
+            if (column >> local.y) & 1 != 0 {
+                chunk_store_lock_blocks(&_chunk_store, pos)
+                id := block_storage_get(chunk.blocks, chunk_block_index(local.x, local.y, local.z))
+                chunk_store_unlock_blocks(&_chunk_store, pos)
+
+                target = RayTarget{
+                    id = u64(id),
+                    pos = voxel,
+                    face = entry_face(axis, dir),
+                    type = .BLOCK,
+                }
+                return target, t, true
+            }
+
+            axis = t_max.x < t_max.y ? (t_max.x < t_max.z ? 0 : 2) : (t_max.y < t_max.z ? 1 : 2)
+            t = t_max[axis]
+            if t > max_distance do return
+            voxel[axis] += step[axis]
+            t_max[axis] += abs(inv[axis])
+        }
+
+        // out through whichever face of the empty box comes first
+        exit := math.inf_f64(1)
+        for i in 0..<3 {
+            if step[i] == 0 do continue
+            bound := step[i] > 0 ? f64(skip.max[i]) + 1 : f64(skip.min[i])
+            if d := (bound - origin[i]) * inv[i]; d < exit do exit, axis = d, i
+        }
+        t = max(t, exit)
+        if t > max_distance do return
+
+        // on the face itself rounding could put us back inside, so that axis is set directly
+        p := origin + dir * t
+        voxel = {i32(math.floor(p.x)), i32(math.floor(p.y)), i32(math.floor(p.z))}
+        voxel[axis] = step[axis] > 0 ? skip.max[axis] + 1 : skip.min[axis] - 1
+    }
+}
+
+// The face of the hit block the ray came in through. A ray that starts
+// inside a block gets the face it points away from the most.
+@(private="file")
+entry_face::proc(axis: int, dir: [3]f64) -> BlockFaces {
+    axis := axis
+    if axis < 0 {
+        a := [3]f64{abs(dir.x), abs(dir.y), abs(dir.z)}
+        axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2)
+    }
+
+    positive := dir[axis] > 0
+    switch axis {
+    case 0: return positive ? .EAST : .NORTH
+    case 1: return positive ? .BOTTOM : .TOP
+    }
+    return positive ? .WEST : .SOUTH
+}
+
+@(private="file")
+cull_mask_is_empty::proc(mask: ^ChunkBitMask) -> bool {
+    for column in mask^ do if column != 0 do return false
+    return true
+}
+
+when utils.ENABLE_BENCHMARKS {
+
+    // Rays in random directions from the camera, so it needs a loaded world.
+    bench_raycast::proc() {
+        COUNT :: 1 << 16
+
+        origin := Position{f64(_camera.pos.x), f64(_camera.pos.y), f64(_camera.pos.z)}
+        rays := make([]Ray, COUNT)
+        defer delete(rays)
+        hits := make([]RayHit, COUNT)
+        defer delete(hits)
+
+        for distance in ([?]f64{8, 64, 256}) {
+            for &ray in rays {
+                ray = Ray{origin, {rand.float64() * 2 - 1, rand.float64() * 2 - 1, rand.float64() * 2 - 1}, distance}
+            }
+
+            start := time.tick_now()
+            hit_count := 0
+            for ray in rays {
+                if _, _, hit := raycast(ray.origin, ray.dir, ray.max_distance); hit do hit_count += 1
+            }
+            single := time.duration_seconds(time.tick_since(start))
+
+            start = time.tick_now()
+            raycast_batch(rays, hits)
+            batched := time.duration_seconds(time.tick_since(start))
+
+            utils.log(.BENCHMARK, "raycast", distance, "blocks:", f64(COUNT) / single, "rays/sec,",
+                f64(COUNT) / batched, "rays/sec batched,", hit_count, "of", COUNT, "hit")
+        }
+    }
+
+}
@@ -0,0 +1,202 @@
+package engine
+
+import "base:runtime"
+import "core:fmt"
+import "core:log"
+import "core:math/rand"
+import "core:os"
+import "core:testing"
+import "core:time"
+
+import "src:utils"
+
+// Random chunks through encoding and decoding, then the same payloads
+// cut short and with bytes overwritten. Cut ones have to be turned down,
+// overwritten ones may decode into other blocks, but never out of bounds.
+@(test)
+test_chunk_payloads_survive_round_trips::proc(t: ^testing.T) {
+    ROUNDS :: 512
+
+    layout, decoded : ChunkLayout
+    storage : BlockStorage
+    defer block_storage_destroy(&storage)
+    payload := make([dynamic]u8, 0, 1024)
+    defer delete(payload)
+    corrupt := make([dynamic]u8, 0, 1024)
+    defer delete(corrupt)
+
+    accepted_corrupt := 0
+    for _ in 0..<ROUNDS {
+        runtime.DEFAULT_TEMP_ALLOCATOR_TEMP_GUARD()
+
+        // anywhere from a single block type to nearly every block its own
+        kinds := 1 << uint(rand.int_max(13))
+        longest_run := 1 << uint(rand.int_max(13))
+        for i := 0; i < BLOCKS_PER_CHUNK; {
+            run := 1 + rand.int_max(longest_run)
+            id := BlockID(rand.int_max(kinds)) * 31
+            for j in i..<min(i + run, BLOCKS_PER_CHUNK) do layout[j] = id
+            i += run
+        }
+
+        block_storage_fill(&storage, layout[:])
+        clear(&payload)
+        encode_chunk_payload(&storage, &payload)
+        if !decode_chunk_payload(payload[:], &decoded) || decoded != layout {
+            testing.expectf(t, false, "a chunk of %d block kinds didn't survive a round trip", len(storage.palette))
+            continue
+        }
+
+        // the last run ends right at the end, so nothing shorter is a whole chunk
+        cut := rand.int_max(len(payload))
+        testing.expectf(t, !decode_chunk_payload(payload[:cut], &decoded), "a payload cut down to %d of %d bytes decoded", cut, len(payload))
+
+        resize(&corrupt, len(payload))
+        copy(corrupt[:], payload[:])
+        for _ in 0..<1 + rand.int_max(8) do corrupt[rand.int_max(len(corrupt))] = u8(rand.int_max(256))
+        if decode_chunk_payload(corrupt[:], &decoded) do accepted_corrupt += 1
+    }
+    log.debugf("%d of %d corrupted payloads still decoded", accepted_corrupt, ROUNDS)
+}
+
+// Saves chunks spread over a few regions, closes them and reads them back
+// from the files, then saves one of them again bigger than it was so it
+// has to move.
+@(test)
+test_region_files_round_trip::proc(t: ^testing.T) {
+    if !use_temp_save_directory(t) do return
+    defer remove_temp_save_directory()
+
+    layouts := make([]ChunkLayout, 8)
+    defer delete(layouts)
+    positions := make([]ChunkPos, len(layouts))
+    defer delete(positions)
+    storage : BlockStorage
+    defer block_storage_destroy(&storage)
+    payload := make([dynamic]u8, 0, 1024)
+    defer delete(payload)
+
+    for &layout, i in layouts {
+        positions[i] = {i32(i) * 5 - 8, 1, 3}
+        for &id, j in layout do id = BlockID(j % (1 + i*7))
+        block_storage_fill(&storage, layout[:])
+        clear(&payload)
+        encode_chunk_payload(&storage, &payload)
+        if !testing.expectf(t, write_chunk_payload(positions[i], payload[:]), "couldn't save chunk %v", positions[i]) do return
+    }
+    for pos in positions {
+        region, _ := chunk_to_region(pos)
+        sync_region(region)
+    }
+    deinit_regions()
+
+    decoded : ChunkLayout
+    for layout, i in layouts {
+        testing.expectf(t, load_chunk(positions[i], &decoded), "chunk %v isn't saved", positions[i])
+        testing.expectf(t, decoded == layout, "chunk %v came back different", positions[i])
+    }
+    testing.expect(t, !load_chunk({0, 0, 3}, &decoded), "a chunk that was never saved loaded")
+
+    // every block its own kind takes more than the one sector it had
+    for &id, j in layouts[0] do id = BlockID(j)
+    block_storage_fill(&storage, layouts[0][:])
+    clear(&payload)
+    encode_chunk_payload(&storage, &payload)
+    testing.expect(t, write_chunk_payload(positions[0], payload[:]))
+    deinit_regions()
+
+    for layout, i in layouts {
+        testing.expectf(t, load_chunk(positions[i], &decoded) && decoded == layout, "chunk %v came back different after the move", positions[i])
+    }
+    free_all(context.temp_allocator)
+}
+
+when utils.ENABLE_BENCHMARKS {
+
+    // How long it takes to load a chunk from disk compared to generating it.
+    // Saves the same way the IO thread does.
+    @(test)
+    bench_region_io::proc(t: ^testing.T) {
+        COUNT :: 512
+
+        if !use_temp_save_directory(t) do return
+        defer remove_temp_save_directory()
+        init_column_cache(&_column_cache, 16)
+        defer destroy_column_cache(&_column_cache)
+
+        layout : ChunkLayout
+        mask : ChunkBitMask
+        storage : BlockStorage
+        defer block_storage_destroy(&storage)
+        payload := make([dynamic]u8, 0, 1024)
+        defer delete(payload)
+
+        positions : [COUNT]ChunkPos
+        for i in 0..<COUNT {
+            positions[i] = {i32(i % 16), i32(i / 16) % 2 - 1, i32(i / 32)} // around the surface
+        }
+
+        start := time.tick_now()
+        for pos in positions {
+            layout = {}
+            generate_chunk_layout(pos, &layout, &mask)
+        }
+        generate_seconds := time.duration_seconds(time.tick_since(start))
+
+        for pos in positions {
+            layout = {}
+            generate_chunk_layout(pos, &layout, &mask)
+            block_storage_fill(&storage, layout[:])
+            clear(&payload)
+            encode_chunk_payload(&storage, &payload)
+            write_chunk_payload(pos, payload[:])
+        }
+        sync_region({0, -1, 0})
+        sync_region({0, 0, 0})
+
+        start = time.tick_now()
+        for pos in positions {
+            load_chunk(pos, &layout)
+            free_all(context.temp_allocator)
+        }
+        load_seconds := time.duration_seconds(time.tick_since(start))
+
+        log.infof("chunks generated: %.0f/sec, loaded from disk: %.0f/sec", f64(COUNT) / generate_seconds, f64(COUNT) / load_seconds)
+    }
+
+}
+
+@(private="file") _saves_before_test : string
+
+// Points the region files at a fresh directory of their own, so the tests
+// never touch a real save.
+@(private="file")
+use_temp_save_directory::proc(t: ^testing.T) -> bool {
+    tmp := os.get_env("TMPDIR", context.temp_allocator)
+    if tmp == "" do tmp = "/tmp"
+    dir := fmt.aprintf("%s/wmac-regions-%x", tmp, rand.uint64())
+
+    err := os.make_directory(dir, 0o755)
+    if !testing.expectf(t, err == nil, "couldn't create %s: %v", dir, err) {
+        delete(dir)
+        return false
+    }
+    _saves_before_test = SAVE_DIRECTORY
+    SAVE_DIRECTORY = dir
+    return true
+}
+
+@(private="file")
+remove_temp_save_directory::proc() {
+    deinit_regions()
+
+    if dir, err := os.open(SAVE_DIRECTORY); err == nil {
+        files, _ := os.read_dir(dir, -1, context.temp_allocator)
+        for file in files do os.remove(file.fullpath)
+        os.close(dir)
+    }
+    os.remove_directory(SAVE_DIRECTORY)
+    delete(SAVE_DIRECTORY)
+    SAVE_DIRECTORY = _saves_before_test
+    free_all(context.temp_allocator)
+}
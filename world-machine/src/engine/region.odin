@@ -0,0 +1,403 @@
+package engine
+
+import "base:intrinsics"
+
+import "core:fmt"
+import "core:os"
+import "core:sync"
+import "core:mem/virtual"
+
+import "src:utils"
+
+// Region files
+//
+// Modified chunks get saved in region files of REGION_SIZE^3 chunks each, named
+// `r.<x>.<y>.<z>.wmr` after the region's position (chunk position >> 4).
+// All numbers are little endian.
+//
+// The file is made of 4KB sectors. The first REGION_HEADER_SECTORS sectors
+// are the header:
+//
+//     u32 magic     "WMRG"
+//     u32 version   REGION_VERSION
+//     u64 reserved
+//     [REGION_CHUNKS]struct {
+//         u32 sector  first sector of the chunk's payload, 0 if it isn't saved
+//         u32 length  payload length in bytes
+//     }
+//
+// indexed by x + y*16 + z*256 of the chunk inside the region. A payload
+// takes up ceil(length / 4KB) sectors in a row:
+//
+//     u16 palette length
+//     [palette length]u32 block ids
+//     runs of { u16 count, u16 palette index } covering all 4096 blocks,
+//     in chunk order (see `chunk_block_index`)
+//
+// A payload is rewritten in place if it still fits in its sectors,
+// otherwise it moves to the end of the file. The sectors it leaves behind
+// aren't reused yet.
+//
+// Reads go through a read-only mapping of the whole file, so loading a
+// saved chunk is a copy out of the page cache.
+
+REGION_SIZE :: 16
+REGION_CHUNKS :: REGION_SIZE * REGION_SIZE * REGION_SIZE
+REGION_SECTOR_SIZE :: 4096
+REGION_MAGIC :: u32(0x47524d57) // "WMRG"
+REGION_VERSION :: u32(1)
+REGION_HEADER_SIZE :: 16 + REGION_CHUNKS * size_of(RegionEntry)
+REGION_HEADER_SECTORS :: (REGION_HEADER_SIZE + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE
+
+SAVE_DIRECTORY := "saves"
+
+RegionPos::[3]i32
+
+RegionEntry::struct #packed {
+    sector: u32,
+    length: u32,
+}
+
+Region::struct {
+    pos: RegionPos,
+    file: os.Handle,
+    mapped: []u8,
+    entries: [REGION_CHUNKS]RegionEntry,
+    next_sector: u32, // end of the file
+    lock: sync.RW_Mutex, // shared for reads, exclusive for writes
+}
+
+// Open region files. Readers hold `_regions_lock` shared for as long as
+// they use a region, so a region can't be closed under them. The IO thread
+// is the only one that closes them, so it lets go right after the lookup
+// and never holds the lock across a write. It's only held exclusively to
+// change the map, never while touching the disk.
+@(private="file") _regions : map[RegionPos]^Region
+@(private="file") _regions_lock : sync.RW_Mutex
+
+// Taken around opening a region file, so the same file is never opened
+// twice at once.
+@(private="file") _open_lock : sync.Mutex
+
+// Regions known to have no file, so loading the chunks of a part of the
+// world that was never saved doesn't ask the file system every time. Only
+// added to with `_regions_lock` held shared and removed from with it held
+// exclusively, see `region_file_exists`.
+@(private="file") _missing_regions : map[RegionPos]struct{}
+@(private="file") _missing_lock : sync.Mutex
+
+init_regions::proc() {
+    if !os.is_dir(SAVE_DIRECTORY) do os.make_directory(SAVE_DIRECTORY, 0o755)
+}
+
+deinit_regions::proc() {
+    sync.rw_mutex_lock(&_regions_lock)
+    defer sync.rw_mutex_unlock(&_regions_lock)
+
+    for _, region in _regions do close_region(region)
+    delete(_regions)
+    _regions = nil
+    delete(_missing_regions)
+    _missing_regions = nil
+}
+
+chunk_to_region::#force_inline proc(pos: ChunkPos) -> (region: RegionPos, index: int) {
+    region = {pos.x >> 4, pos.y >> 4, pos.z >> 4}
+    local := [3]i32{pos.x & (REGION_SIZE - 1), pos.y & (REGION_SIZE - 1), pos.z & (REGION_SIZE - 1)}
+    return region, int(local.x) + int(local.y)*REGION_SIZE + int(local.z)*REGION_SIZE*REGION_SIZE
+}
+
+// Fills `layout` with the saved chunk, if there is one. Safe to call from
+// any thread.
+load_chunk::proc(pos: ChunkPos, layout: ^ChunkLayout) -> (ok: bool) {
+    region_pos, index := chunk_to_region(pos)
+
+    sync.rw_mutex_shared_lock(&_regions_lock)
+    defer sync.rw_mutex_shared_unlock(&_regions_lock)
+
+    region := _regions[region_pos]
+    if region == nil {
+        // only open it if there's a file to open, most of the world isn't saved
+        if !region_file_exists(region_pos) do return false
+
+        sync.rw_mutex_shared_unlock(&_regions_lock)
+        ensure_region_open(region_pos)
+        sync.rw_mutex_shared_lock(&_regions_lock)
+
+        region = _regions[region_pos]
+        if region == nil do return false
+    }
+
+    sync.rw_mutex_shared_lock(&region.lock)
+    defer sync.rw_mutex_shared_unlock(&region.lock)
+
+    entry := region.entries[index]
+    if entry.sector == 0 do return false
+
+    start := int(entry.sector) * REGION_SECTOR_SIZE
+    end := start + int(entry.length)
+    if end > len(region.mapped) {
+        utils.log(.ERROR, "Chunk", pos, "points past the end of its region file")
+        return false
+    }
+    return decode_chunk_payload(region.mapped[start:end], layout)
+}
+
+// Writes an encoded chunk to its region file, creating the file if needed.
+// IO thread only (the tests aside), it uses the region without holding
+// `_regions_lock`.
+write_chunk_payload::proc(pos: ChunkPos, payload: []u8) -> (ok: bool) {
+    region_pos, index := chunk_to_region(pos)
+
+    region := find_region(region_pos)
+    if region == nil {
+        ensure_region_open(region_pos)
+        region = find_region(region_pos)
+        if region == nil do return false
+    }
+
+    sync.rw_mutex_lock(&region.lock)
+    defer sync.rw_mutex_unlock(&region.lock)
+
+    entry := &region.entries[index]
+    sectors := u32((len(payload) + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE)
+    old_sectors := (entry.length + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE
+
+    sector := entry.sector
+    if sector == 0 || sectors > old_sectors {
+        sector = region.next_sector
+        region.next_sector += sectors
+    }
+
+    if _, err := os.write_at(region.file, payload, i64(sector) * REGION_SECTOR_SIZE); err != nil {
+        utils.log(.ERROR, "Failed to save chunk", pos, err)
+        return false
+    }
+
+    entry^ = RegionEntry{sector = sector, length = u32(len(payload))}
+    entry_bytes := transmute([size_of(RegionEntry)]u8)entry^
+    if _, err := os.write_at(region.file, entry_bytes[:], i64(16 + index * size_of(RegionEntry))); err != nil {
+        utils.log(.ERROR, "Failed to update region header for", pos, err)
+        return false
+    }
+
+    // the mapping only covers the file as it was, readers need the new end too
+    if int(region.next_sector) * REGION_SECTOR_SIZE > len(region.mapped) do remap_region(region)
+    return true
+}
+
+// Makes sure everything written to the region so far is on the disk. IO
+// thread only: regions only get closed there, so the region can't go away
+// once we have it and the sync doesn't need to hold up anyone else.
+sync_region::proc(pos: RegionPos) {
+    region := find_region(pos)
+    if region == nil do return
+    if err := os.flush(region.file); err != nil {
+        utils.log(.ERROR, "Failed to sync region file", pos, err)
+    }
+}
+
+// Opens the region and pulls it into the page cache, so loading its
+// chunks later doesn't wait on the disk. Regions that were never saved
+// are left alone. IO thread only, like `write_chunk_payload`.
+prefetch_region::proc(pos: RegionPos) {
+    sync.rw_mutex_shared_lock(&_regions_lock)
+    exists := pos in _regions || region_file_exists(pos)
+    sync.rw_mutex_shared_unlock(&_regions_lock)
+    if !exists do return
+    ensure_region_open(pos)
+
+    region := find_region(pos)
+    if region == nil do return
+
+    sync.rw_mutex_shared_lock(&region.lock)
+    defer sync.rw_mutex_shared_unlock(&region.lock)
+
+    for i := 0; i < len(region.mapped); i += REGION_SECTOR_SIZE {
+        intrinsics.volatile_load(&region.mapped[i])
+    }
+}
+
+// Closes the regions that are out of reach of `center`. IO thread only,
+// this waits for the writes in progress.
+close_far_regions::proc(center: ChunkPos, radius: i32) {
+    center_region, _ := chunk_to_region(center)
+    reach := radius / REGION_SIZE + 2 // one more for the prefetched ones
+
+    sync.rw_mutex_lock(&_regions_lock)
+    defer sync.rw_mutex_unlock(&_regions_lock)
+
+    for pos, region in _regions {
+        d := pos - center_region
+        if max(abs(d.x), abs(d.y), abs(d.z)) <= reach do continue
+        close_region(region)
+        delete_key(&_regions, pos)
+    }
+}
+
+@(private="file")
+region_path::proc(pos: RegionPos, allocator := context.allocator) -> string {
+    return fmt.aprintf("%s/r.%d.%d.%d.wmr", SAVE_DIRECTORY, pos.x, pos.y, pos.z, allocator = allocator)
+}
+
+// Needs `_regions_lock` held shared, which keeps the region from being
+// created between the check and remembering that it's missing.
+@(private="file")
+region_file_exists::proc(pos: RegionPos) -> bool {
+    sync.mutex_lock(&_missing_lock)
+    _, missing := _missing_regions[pos]
+    sync.mutex_unlock(&_missing_lock)
+    if missing do return false
+
+    if os.exists(region_path(pos, context.temp_allocator)) do return true
+
+    sync.mutex_lock(&_missing_lock)
+    _missing_regions[pos] = {}
+    sync.mutex_unlock(&_missing_lock)
+    return false
+}
+
+// Opens (or creates) the region, unless another thread beat us to it.
+// Loads and saves of other regions carry on while the file is opened,
+// `_regions_lock` is only taken exclusively to add it to the map.
+@(private="file")
+ensure_region_open::proc(pos: RegionPos) {
+    sync.mutex_lock(&_open_lock)
+    defer sync.mutex_unlock(&_open_lock)
+
+    if find_region(pos) != nil do return
+    region := open_region(pos)
+    if region == nil do return
+
+    sync.rw_mutex_lock(&_regions_lock)
+    defer sync.rw_mutex_unlock(&_regions_lock)
+
+    _regions[pos] = region
+    sync.mutex_lock(&_missing_lock)
+    delete_key(&_missing_regions, pos)
+    sync.mutex_unlock(&_missing_lock)
+}
+
+// Only safe to use the region afterwards on the IO thread, anyone else has
+// to keep holding `_regions_lock` shared.
+@(private="file")
+find_region::proc(pos: RegionPos) -> ^Region {
+    sync.rw_mutex_shared_lock(&_regions_lock)
+    defer sync.rw_mutex_shared_unlock(&_regions_lock)
+    return _regions[pos]
+}
+
+@(private="file")
+open_region::proc(pos: RegionPos) -> ^Region {
+    path := region_path(pos, context.temp_allocator)
+    file, err := os.open(path, os.O_RDWR | os.O_CREATE, 0o644)
+    if err != nil {
+        utils.log(.ERROR, "Failed to open region file", path, err)
+        return nil
+    }
+
+    region := new(Region)
+    region.pos = pos
+    region.file = file
+
+    size, _ := os.file_size(file)
+    if size < REGION_HEADER_SIZE {
+        // new file, give it an empty header
+        header := make([]u8, REGION_HEADER_SECTORS * REGION_SECTOR_SIZE, context.temp_allocator)
+        (^u32)(&header[0])^ = REGION_MAGIC
+        (^u32)(&header[4])^ = REGION_VERSION
+        if _, write_err := os.write_at(file, header, 0); write_err != nil {
+            utils.log(.ERROR, "Failed to write the header of region file", path, write_err)
+            os.close(file)
+            free(region)
+            return nil
+        }
+        size = i64(len(header))
+    } else {
+        preamble : [16]u8
+        os.read_at(file, preamble[:], 0)
+        magic := (^u32)(&preamble[0])^
+        version := (^u32)(&preamble[4])^
+        if magic != REGION_MAGIC || version != REGION_VERSION {
+            utils.log(.ERROR, "Region file", path, "has an unknown format, ignoring it")
+            os.close(file)
+            free(region)
+            return nil
+        }
+        os.read_at(file, ([^]u8)(&region.entries)[:size_of(region.entries)], 16)
+    }
+
+    region.next_sector = u32((size + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE)
+    remap_region(region)
+    return region
+}
+
+@(private="file")
+remap_region::proc(region: ^Region) {
+    if region.mapped != nil do virtual.unmap_file(region.mapped)
+    region.mapped = nil
+
+    data, err := virtual.map_file_from_file_descriptor(uintptr(region.file), {.Read})
+    if err != nil {
+        utils.log(.ERROR, "Failed to map region file", region.pos, err)
+        return
+    }
+    region.mapped = data
+}
+
+@(private="file")
+close_region::proc(region: ^Region) {
+    if region.mapped != nil do virtual.unmap_file(region.mapped)
+    os.close(region.file)
+    free(region)
+}
+
+encode_chunk_payload::proc(blocks: ^BlockStorage, out: ^[dynamic]u8) {
+    put :: #force_inline proc(out: ^[dynamic]u8, value: $T) {
+        value := value
+        append(out, ..(transmute([size_of(T)]u8)value)[:])
+    }
+
+    put(out, u16(len(blocks.palette)))
+    for id in blocks.palette do put(out, u32(id))
+
+    // runs straight from the packed indices, no need to decode the blocks
+    run_index := block_storage_index(blocks, 0)
+    run_count := u16(0)
+    for i in 0..<BLOCKS_PER_CHUNK {
+        idx := block_storage_index(blocks, i)
+        if idx != run_index {
+            put(out, run_count)
+            put(out, u16(run_index))
+            run_index, run_count = idx, 0
+        }
+        run_count += 1
+    }
+    put(out, run_count)
+    put(out, u16(run_index))
+}
+
+decode_chunk_payload::proc(data: []u8, layout: ^ChunkLayout) -> (ok: bool) {
+    cursor := 0
+    get :: #force_inline proc(data: []u8, cursor: ^int, $T: typeid) -> (value: T, ok: bool) {
+        if cursor^ + size_of(T) > len(data) do return {}, false
+        value = (^T)(&data[cursor^])^
+        cursor^ += size_of(T)
+        return value, true
+    }
+
+    palette_len := get(data, &cursor, u16) or_return
+    palette := make([]BlockID, palette_len, context.temp_allocator)
+    for &id in palette do id = BlockID(get(data, &cursor, u32) or_return)
+
+    i := 0
+    for i < BLOCKS_PER_CHUNK {
+        count := int(get(data, &cursor, u16) or_return)
+        idx := int(get(data, &cursor, u16) or_return)
+        if idx >= len(palette) || i + count > BLOCKS_PER_CHUNK do return false
+
+        for j in i..<i+count do layout[j] = palette[idx]
+        i += count
+    }
+    return true
+}
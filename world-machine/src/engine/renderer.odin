@@ -2,8 +2,8 @@ package engine
 
 import "core:time"
 import "core:math/linalg"
-import "core:math/bits"
-import "core:fmt"
+import "core:sync"
+import "core:slice"
 
 import sdl "vendor:sdl2"
 import gl "vendor:OpenGL"
@@ -38,28 +38,75 @@ _block_mesh : struct {
             vbo: GPUBuffer,
             buffer: [dynamic]u64,
             size: int,
+            ranges: utils.RangeAllocator, // every chunk's slice of `buffer`
+            gpu: GPUMirror,
         },
         indirect: struct {
             vbo: GPUBuffer,
             buffer: [dynamic]IndirectCommand,
+            ranges: [dynamic]utils.RangeHandle, // same order as `buffer`
+            gpu: GPUMirror,
         },
         ssb: struct {
             vbo: GPUBuffer,
             buffer: [dynamic][4]i32,
+            gpu: GPUMirror,
         },
     },
+    uploaded_bytes: int, // last frame
     vao: u32,
-    
+
+    // what actually gets drawn after culling
+    culled: struct {
+        indirect_vbo: GPUBuffer,
+        commands: [dynamic]IndirectCommand, // CPU culling only
+        gpu: GPUMirror,
+        stats: CullStats,
+    },
+    cull_shader: struct {
+        program: Shader,
+        planes: ShaderUniform,
+        draw_count: ShaderUniform,
+        ok: bool,
+    },
 } = {}
 
+// Filled by every generator thread, so both ends take the lock.
 @(private)
 _render_chunks_to_update : utils.Queue(ChunkPos)
+@(private)
+_render_queue_lock : sync.Mutex
+// Chunks sitting in `_render_chunks_to_update`, so they're only queued once.
+// The value says whether the chunk itself changed, rather than a neighbour.
+@(private="file")
+_render_chunks_queued : map[ChunkPos]bool
 
 @(private)
 _render_chunks_to_deactivate : utils.Queue(ChunkPos)
 
+// Where every drawn chunk sits in the indirect, ranges and ssb buffers.
 @(private="file")
-_should_update_blocks_mesh := false
+_draw_slots : map[ChunkPos]int
+
+// What the GPU side of a buffer looks like compared to its CPU copy.
+// Only the parts that changed since the last frame get uploaded.
+@(private="file")
+GPUMirror::struct {
+    capacity: int, // in elements
+    dirty: [dynamic]DirtyRange,
+}
+
+// In elements, end is exclusive.
+@(private)
+DirtyRange::struct {
+    start, end: int,
+}
+
+// Ranges closer than this get uploaded in one call.
+@(private="file") DIRTY_MERGE_GAP :: 64
+
+@(private="file") INITIAL_INSTANCE_CAPACITY :: 1 << 16
+@(private="file") COMPACTION_CHECK_INTERVAL :: time.Second
 
 init_block_atlas::proc() {
     _block_atlas_strip = {
@@ -159,28 +206,91 @@ init_block_mesh::proc() {
         gl.GenBuffers(1, &_block_mesh.bufs.attrib.vbo)
         gl.GenBuffers(1, &_block_mesh.bufs.indirect.vbo)
         gl.GenBuffers(1, &_block_mesh.bufs.ssb.vbo)
+        gl.GenBuffers(1, &_block_mesh.culled.indirect_vbo)
+
+        // the pointer sticks to the buffer object, even when it gets reallocated
+        gl.BindBuffer(gl.ARRAY_BUFFER, _block_mesh.bufs.attrib.vbo)
+        gl.VertexAttribIPointer(0, 2, gl.UNSIGNED_INT, size_of(u64), 0)
+        gl.VertexAttribDivisor(0, 1)
+        gl.EnableVertexAttribArray(0)
+        gl.BindBuffer(gl.ARRAY_BUFFER, 0)
     gl.BindVertexArray(0)
 
+    // compute shaders are core in 4.3, but drivers still manage to not have them
+    if gl.DispatchCompute != nil {
+        cull_shader, cull_ok := gl.load_compute_source(#load("res:shaders/cull.comp"))
+        _block_mesh.cull_shader = {
+            program = cull_shader,
+            planes = gl.GetUniformLocation(cull_shader, "planes"),
+            draw_count = gl.GetUniformLocation(cull_shader, "drawCount"),
+            ok = cull_ok,
+        }
+    }
+    if !_block_mesh.cull_shader.ok {
+        utils.log(.WARNING, "GPU culling isn't available, falling back to the CPU")
+    }
+
     _render_chunks_to_update = utils.create_queue(ChunkPos)
     _render_chunks_to_deactivate = utils.create_queue(ChunkPos)
+    _meshes_ready = utils.create_mpmc_queue(^ChunkMesh, max_meshes_in_flight())
+    _block_mesh.bufs.attrib.ranges = utils.create_range_allocator(INITIAL_INSTANCE_CAPACITY)
+}
+
+// Can be called from any thread. `changed` is false when the chunk only
+// needs a new mesh because one of its neighbours showed up or went away.
+queue_chunk_remesh::proc(pos: ChunkPos, changed := true) {
+    sync.mutex_lock(&_render_queue_lock)
+    defer sync.mutex_unlock(&_render_queue_lock)
+
+    if was_changed, queued := _render_chunks_queued[pos]; queued {
+        _render_chunks_queued[pos] = was_changed || changed
+        return
+    }
+    _render_chunks_queued[pos] = changed
+    utils.enqueue(&_render_chunks_to_update, pos)
 }
 
 render_update::proc() {
     using utils
 
-    for {
-        if is_empty(&_render_chunks_to_update) do break
-        chunk_pos := dequeue(&_render_chunks_to_update)
-        render_update_chunk(chunk_pos)
-        if mean_frame_time() > 5 * time.Millisecond do break
+    flush_block_edits()
+
+    for _meshes_in_flight < max_meshes_in_flight() {
+        sync.mutex_lock(&_render_queue_lock)
+        chunk_pos, ok := dequeue(&_render_chunks_to_update)
+        changed := false
+        if ok do _, changed = delete_key(&_render_chunks_queued, chunk_pos)
+        sync.mutex_unlock(&_render_queue_lock)
+        if !ok do break
+        render_update_chunk(chunk_pos, changed)
+    }
+
+    // the copies are what costs us frame time here, so they're what's capped
+    uploaded := 0
+    for uploaded < MESH_UPLOAD_BUDGET {
+        mesh, ok := dequeue(&_meshes_ready)
+        if !ok do break
+        _meshes_in_flight -= 1
+        uploaded += len(mesh.data) * size_of(BlockVertData)
+
+        apply_chunk_mesh(mesh)
+        append(&_free_meshes, mesh)
     }
     for {
         if is_empty(&_render_chunks_to_deactivate) do break
         chunk_pos := dequeue(&_render_chunks_to_deactivate)
-        render_deactivate_chunk(chunk_pos)
+        // it might have been loaded again since
+        if !chunk_store_has(&_chunk_store, chunk_pos) do render_deactivate_chunk(chunk_pos)
         if mean_frame_time() > 5 * time.Millisecond do break
     }
 
+    @(static) last_compaction_check : time.Tick
+    if time.tick_since(last_compaction_check) > COMPACTION_CHECK_INTERVAL {
+        last_compaction_check = time.tick_now()
+        stats := get_instance_buffer_stats()
+        if stats.free > stats.capacity / 2 && stats.fragmentation > 0.5 do compact_instance_buffer()
+    }
+
     if len(_block_mesh.bufs.indirect.buffer) > 0 do draw_blocks()
 }
 
@@ -199,32 +309,125 @@ draw_blocks::proc() {
         gl.BindTexture(gl.TEXTURE_2D, _block_atlas_id)
         gl.Uniform1i(shader.tex, 0)
 
-        if _should_update_blocks_mesh {
-            gl.BindBuffer(gl.SHADER_STORAGE_BUFFER, bufs.ssb.vbo); {
-                defer gl.BindBuffer(gl.SHADER_STORAGE_BUFFER, 0)
-                gl.BufferData(gl.SHADER_STORAGE_BUFFER, len(bufs.ssb.buffer) * size_of([4]i32), &bufs.ssb.buffer[0], gl.DYNAMIC_DRAW)
-                gl.BindBufferBase(gl.SHADER_STORAGE_BUFFER, 3, bufs.ssb.vbo)
-            }
-
-            gl.BindBuffer(gl.ARRAY_BUFFER, bufs.attrib.vbo); {
-                defer gl.BindBuffer(gl.ARRAY_BUFFER, 0)
-                gl.BufferData(gl.ARRAY_BUFFER, bufs.attrib.size * size_of(u64), &bufs.attrib.buffer[0], gl.DYNAMIC_DRAW)
-                gl.VertexAttribIPointer(0, 2, gl.UNSIGNED_INT, size_of(u64), 0)
-                gl.VertexAttribDivisor(0, 1)
-                gl.EnableVertexAttribArray(0)
+        uploaded_bytes = 0
+        uploaded_bytes += flush_gpu_mirror(gl.SHADER_STORAGE_BUFFER, bufs.ssb.vbo, bufs.ssb.buffer[:], &bufs.ssb.gpu)
+        uploaded_bytes += flush_gpu_mirror(gl.ARRAY_BUFFER, bufs.attrib.vbo, bufs.attrib.buffer[:bufs.attrib.size], &bufs.attrib.gpu)
+        uploaded_bytes += flush_gpu_mirror(gl.DRAW_INDIRECT_BUFFER, bufs.indirect.vbo, bufs.indirect.buffer[:], &bufs.indirect.gpu)
+
+        mode := CULLING_MODE
+        if mode == .GPU && !cull_shader.ok do mode = .CPU
+
+        switch mode {
+        case .NONE:
+            gl.BindBufferBase(gl.SHADER_STORAGE_BUFFER, 3, bufs.ssb.vbo)
+            gl.BindBuffer(gl.DRAW_INDIRECT_BUFFER, bufs.indirect.vbo)
+            gl.MultiDrawArraysIndirect(gl.TRIANGLE_STRIP, nil, i32(len(bufs.indirect.buffer)), 0)
+
+        case .CPU:
+            frustum := frustum_from_matrix(mvp)
+            culled.stats = cull_chunks(&frustum, bufs.ssb.buffer[:], bufs.indirect.buffer[:], &culled.commands, &culled.gpu.dirty)
+            uploaded_bytes += flush_gpu_mirror(gl.DRAW_INDIRECT_BUFFER, culled.indirect_vbo, culled.commands[:], &culled.gpu)
+            if culled.stats.chunks_visible == 0 do break
+
+            // not compacted: culled commands stay in place with no instances, since
+            // the shader finds the chunk position by gl_DrawID. The GPU skips them
+            // for next to nothing, and only what changed gets uploaded.
+            gl.BindBufferBase(gl.SHADER_STORAGE_BUFFER, 3, bufs.ssb.vbo)
+            gl.BindBuffer(gl.DRAW_INDIRECT_BUFFER, culled.indirect_vbo)
+            gl.MultiDrawArraysIndirect(gl.TRIANGLE_STRIP, nil, i32(len(culled.commands)), 0)
+
+        case .GPU:
+            draw_count := i32(len(bufs.indirect.buffer))
+            frustum := frustum_from_matrix(mvp)
+
+            // the output buffer has to be as big as the input one, it only
+            // gets reallocated when that grew past it
+            if int(draw_count) > culled.gpu.capacity {
+                culled.gpu.capacity = max(int(draw_count), 2*culled.gpu.capacity, 1024)
+                gl.BindBuffer(gl.SHADER_STORAGE_BUFFER, culled.indirect_vbo)
+                gl.BufferData(gl.SHADER_STORAGE_BUFFER, culled.gpu.capacity * size_of(IndirectCommand), nil, gl.DYNAMIC_DRAW)
+                gl.BindBuffer(gl.SHADER_STORAGE_BUFFER, 0)
             }
 
-            gl.BindBuffer(gl.DRAW_INDIRECT_BUFFER, bufs.indirect.vbo); {
-                defer gl.BindBuffer(gl.DRAW_INDIRECT_BUFFER, 0)
-                gl.BufferData(gl.DRAW_INDIRECT_BUFFER, len(bufs.indirect.buffer) * size_of(IndirectCommand), &bufs.indirect.buffer[0], gl.DYNAMIC_DRAW)
+            // the shader overwrites what CPU culling had uploaded, so it
+            // uploads everything again if it's back
+            clear(&culled.commands)
+
+            gl.UseProgram(cull_shader.program)
+            gl.Uniform4fv(cull_shader.planes, 6, &frustum[0][0])
+            gl.Uniform1ui(cull_shader.draw_count, u32(draw_count))
+            gl.BindBufferBase(gl.SHADER_STORAGE_BUFFER, 3, bufs.ssb.vbo)
+            gl.BindBufferBase(gl.SHADER_STORAGE_BUFFER, 4, bufs.indirect.vbo)
+            gl.BindBufferBase(gl.SHADER_STORAGE_BUFFER, 5, culled.indirect_vbo)
+            gl.DispatchCompute(u32(draw_count + 63) / 64, 1, 1)
+            gl.MemoryBarrier(gl.COMMAND_BARRIER_BIT | gl.SHADER_STORAGE_BARRIER_BIT)
+
+            // the GPU doesn't tell us what it culled, so these are only totals
+            culled.stats = CullStats{
+                chunks_total = int(draw_count),
+                chunks_visible = int(draw_count),
+                instances_total = bufs.attrib.size,
+                instances_visible = bufs.attrib.size,
             }
 
-            _should_update_blocks_mesh = false
+            gl.UseProgram(shader.program)
+            gl.BindBuffer(gl.DRAW_INDIRECT_BUFFER, culled.indirect_vbo)
+            gl.MultiDrawArraysIndirect(gl.TRIANGLE_STRIP, nil, draw_count, 0)
         }
+    }
+}
 
-        gl.BindBuffer(gl.DRAW_INDIRECT_BUFFER, bufs.indirect.vbo)
-        gl.MultiDrawArraysIndirect(gl.TRIANGLE_STRIP, nil, i32(len(bufs.indirect.buffer)), 0)
+get_uploaded_bytes::proc() -> int {
+    return _block_mesh.uploaded_bytes
+}
+
+@(private="file")
+mark_dirty::#force_inline proc(mirror: ^GPUMirror, #any_int start, end: int) {
+    append(&mirror.dirty, DirtyRange{start, end})
+}
+
+// Uploads whatever changed in `data` since the last flush. The GPU buffer
+// grows geometrically, and growing means uploading all of it once.
+@(private="file")
+flush_gpu_mirror::proc(target: u32, vbo: GPUBuffer, data: []$T, mirror: ^GPUMirror) -> (uploaded: int) {
+    defer clear(&mirror.dirty)
+    if len(data) == 0 do return 0
+
+    gl.BindBuffer(target, vbo)
+    defer gl.BindBuffer(target, 0)
+
+    if len(data) > mirror.capacity {
+        mirror.capacity = max(len(data), 2*mirror.capacity, 1024)
+        gl.BufferData(target, mirror.capacity * size_of(T), nil, gl.DYNAMIC_DRAW)
+        gl.BufferSubData(target, 0, len(data) * size_of(T), raw_data(data))
+        return len(data) * size_of(T)
     }
+    if len(mirror.dirty) == 0 do return 0
+
+    slice.sort_by(mirror.dirty[:], proc(a, b: DirtyRange) -> bool { return a.start < b.start })
+
+    upload :: proc(target: u32, data: []$T, r: DirtyRange) -> int {
+        end := min(r.end, len(data))
+        if r.start >= end do return 0
+        gl.BufferSubData(target, r.start * size_of(T), (end - r.start) * size_of(T), &data[r.start])
+        return (end - r.start) * size_of(T)
+    }
+
+    current := mirror.dirty[0]
+    for r in mirror.dirty[1:] {
+        if r.start <= current.end + DIRTY_MERGE_GAP {
+            current.end = max(current.end, r.end)
+            continue
+        }
+        uploaded += upload(target, data, current)
+        current = r
+    }
+    uploaded += upload(target, data, current)
+    return uploaded
+}
+
+get_cull_stats::proc() -> CullStats {
+    return _block_mesh.culled.stats
 }
 
 @(private="file")
@@ -249,401 +452,172 @@ compute_mvp::#force_inline proc() -> linalg.Matrix4f32 {
     return proj * view * model
 }
 
-@(private="file")
-render_activate_chunk::proc(pos: ChunkPos) {
-    data, size := calculate_chunk_data(pos)
-    if size == 0 do return
-    edit_mesh(pos, data[:], size)
-
-    _should_update_blocks_mesh = true
-}
+// Chunks that get re-meshed more often than this go through the cheaper
+// per-face mesher instead of the greedy one.
+@(private="file") HOT_CHUNK_INTERVAL :: 500 * time.Millisecond
+@(private="file") _last_meshed : map[ChunkPos]time.Tick
 
-@(private="file")
-render_update_chunk::proc(pos: ChunkPos) {
-    data, size := calculate_chunk_data(pos)
-    if size == 0 {
-        render_deactivate_chunk(pos)
-        return
-    }
-    edit_mesh(pos, data[:], size)
+// Meshes get built on the job threads, the main thread only hands out
+// chunks and copies the finished meshes into the draw buffers.
+@(private="file") MESHES_IN_FLIGHT_PER_WORKER :: 4
+@(private="file") MESH_UPLOAD_BUDGET :: 2 * 1024 * 1024 // bytes of meshes taken in per frame
 
-    _should_update_blocks_mesh = true
-}
+// Latest generation handed out for every chunk that has a mesh in flight.
+@(private="file") _mesh_generations : map[ChunkPos]u32
+@(private="file") _mesh_generation_counter : u32
+@(private="file") _meshes_in_flight : int
+@(private="file") _free_meshes : [dynamic]^ChunkMesh
 
 @(private="file")
-render_deactivate_chunk::proc(pos: ChunkPos) {
-    // TODO: implement
+max_meshes_in_flight::proc() -> int {
+    return max(len(_jobs.workers), 1) * MESHES_IN_FLIGHT_PER_WORKER
 }
 
-// i hate this whole entire thing going here
-
-@(private="file") CS :: 16 // chunk size
-@(private="file") CS_2 :: CS * CS // squared
-
 @(private="file")
-BlockVertData::u64
+render_update_chunk::proc(pos: ChunkPos, changed: bool) {
+    mode := MESHING_MODE
+    if changed {
+        now := time.tick_now()
+        if last, ok := _last_meshed[pos]; ok && time.tick_diff(last, now) < HOT_CHUNK_INTERVAL {
+            mode = .PER_FACE
+        }
+        _last_meshed[pos] = now
+    }
 
-@(private="file")
-create_mesh_data::#force_inline proc(
-    #any_int pos_x, pos_y, pos_z: int,
-    #any_int size_u, size_v: int,
-    #any_int face: int,
-    #any_int texture: int
-) -> BlockVertData {
-    tex_u, tex_v := texture % TILES_PER_ROW, texture / TILES_PER_ROW
-    return BlockVertData(
-        (u64(pos_x) << 0) | (u64(pos_y) << 5) | (u64(pos_z) << 10) | // 5 bits each
-        (u64(size_u) << 15) | (u64(size_v) << 20) | // 5 bits each
-        (u64(face) << 25) | // 3 bits
-        (u64(tex_u) << 32) | (u64(tex_v) << 48) // 16 bits each 
-    )
-    // here's a visualized memory layout
-    // XXXXXYYY YYZZZZZU UUUUVVVV VFFF----
-    // UUUUUUUU UUUUUUUU VVVVVVVV VVVVVVVV
-}
+    // any mesh of this chunk that's still in flight is outdated now
+    _mesh_generation_counter += 1
+    _mesh_generations[pos] = _mesh_generation_counter
 
-get_axis_idx::#force_inline proc(axis: int, #any_int a, b, c: int) -> int {
-    switch axis {
-        case 0: return b + CS*a + CS_2*c
-        case 1: return b + CS*c + CS_2*a
-        case 2: return c + CS*a + CS_2*b
+    mesh : ^ChunkMesh
+    if len(_free_meshes) > 0 {
+        mesh = pop(&_free_meshes)
+    } else {
+        mesh = new(ChunkMesh)
     }
-    return 0
+    mesh.pos = pos
+    mesh.generation = _mesh_generation_counter
+    mesh.mode = mode
+
+    _meshes_in_flight += 1
+    utils.submit(&_jobs, utils.make_job(mesh_chunk_job, mesh, &_mesh_group))
 }
 
 @(private="file")
-calculate_chunk_data::proc(pos: ChunkPos) -> (vertex_data: [6*CS*CS*CS]BlockVertData, size: u32) {
-    size = 0
-
-    chunk := _chunks[pos]
-
-    cull_mask := chunk.cull_mask^
-    face_masks := [BlockFaces]ChunkBitMask{}
-
-    // https://github.com/cgerikj/binary-greedy-meshing/blob/master/src/mesher.h
+apply_chunk_mesh::proc(mesh: ^ChunkMesh) {
+    generation, ok := _mesh_generations[mesh.pos]
+    if !ok || generation != mesh.generation do return
+    delete_key(&_mesh_generations, mesh.pos)
 
-    for a in 1..<16-1 {
-        aCS := a * CS 
-        for b in 1..<16-1 {
-            column := cull_mask[aCS + b]
+    // unloaded while it was being meshed, its deactivation is already queued
+    if !chunk_store_has(&_chunk_store, mesh.pos) do return
 
-            ba_idx := (b-1) + (a-1)*CS
-            ab_idx := (a-1) + (b-1)*CS
-            
-            face_masks[.NORTH][ab_idx]  = column & ~cull_mask[aCS + b + 1]
-            face_masks[.EAST][ab_idx]   = column & ~cull_mask[aCS + b - 1]
-
-            face_masks[.SOUTH][ba_idx]  = column & ~cull_mask[aCS + b + CS]
-            face_masks[.WEST][ba_idx]   = column & ~cull_mask[aCS + b - CS]
-
-            face_masks[.TOP][ab_idx]    = column & ~(cull_mask[aCS + b] >> 1)
-            face_masks[.BOTTOM][ab_idx] = column & ~(cull_mask[aCS + b] << 1)
-        }
+    if len(mesh.data) == 0 {
+        render_deactivate_chunk(mesh.pos)
+        return
     }
+    edit_mesh(mesh.pos, mesh.data[:], u32(len(mesh.data)))
+}
 
-    if chunk.large != nil {
-        // don't run the greedy mesher for large chunks
-        // instead run a simple face culler
+// Called by the world before the chunks go away, so no mesh job is left
+// reading them.
+wait_for_mesh_jobs::proc() {
+    utils.wait_for_group(&_jobs, &_mesh_group)
 
-        // blocks := chunk.large.data
-        // TODO: can't be bothered rn
+    for {
+        mesh, ok := utils.dequeue(&_meshes_ready)
+        if !ok do break
+        append(&_free_meshes, mesh)
+    }
+    _meshes_in_flight = 0
 
-    } else {
-        // run the greedy mesher
-        
-        blocks := chunk.small.data
-        
-        for face in BlockFaces {
-            face_casted := int(face)
-            axis := face_casted / 2
-
-            forward_merged := [CS_2]u8{}
-            right_merged := [CS]u8{}
-
-            switch axis {
-            case 0, 1:
-                for layer in 0..<CS {
-                    bits_idx := layer*CS
-
-                    for forward in 0..<CS {
-                        bits_here := face_masks[face][forward + bits_idx]
-                        if bits_here == 0 do continue
-
-                        next_bits := face_masks[face][forward+1 + bits_idx] if forward < CS-1 else 0
-
-                        right_merged := u8(1)
-
-                        for bits_here > 0 {
-                            bit_pos := u8(bits.trailing_zeros(bits_here))
-                            // if bit_pos == 0 do continue
-                            
-                            block := blocks[get_axis_idx(axis, forward+1, bit_pos+1, layer+1)]
-
-                            forward_merged_ref := &forward_merged[bit_pos]
-
-                            if (
-                                (next_bits >> bit_pos & 1 != 0) &&
-                                (block == blocks[get_axis_idx(axis, forward+2, bit_pos+1, layer+1)]) \
-                            ) {
-                                forward_merged_ref^ += 1
-                                bits_here &=  ~(1 << bit_pos)
-                                continue
-                            }
-
-                            for right in (bit_pos+1)..<CS {
-                                if (
-                                    ((bits_here >> right & 1) == 0) ||
-                                    (forward_merged_ref^ != forward_merged[right]) ||
-                                    (block != blocks[get_axis_idx(axis, forward+1, right+1, layer+1)]) \
-                                ) {
-                                    break
-                                }
-                                forward_merged[right] = 0
-                                right_merged += 1
-                            }
-                            forward_merged_ref^ &= ~((1 << (bit_pos + right_merged)) - 1)
-
-                            mesh_front  := u8(forward) - forward_merged_ref^
-                            mesh_left   := bit_pos
-                            mesh_up     := layer + (~face_casted & 1)
-
-                            mesh_width  := right_merged
-                            mesh_length := forward_merged_ref^ + 1
-
-                            forward_merged_ref^ = 0
-                            right_merged = 1
-
-                            switch axis {
-                            case 0: vertex_data[size] = create_mesh_data(
-                                pos_x   = mesh_front + (face_casted==1 ? mesh_length : 0),
-                                pos_y   = mesh_up,
-                                pos_z   = mesh_left,
-                                size_u  = mesh_length,
-                                size_v  = mesh_width,
-                                face    = face_casted,
-                                texture = chunk.small.blocks[block-1]
-                            )
-                            case 1: vertex_data[size] = create_mesh_data(
-                                pos_x   = mesh_up,
-                                pos_y   = mesh_front + (face_casted==2 ? mesh_length : 0),
-                                pos_z   = mesh_left,
-                                size_u  = mesh_length,
-                                size_v  = mesh_width,
-                                face    = face_casted,
-                                texture = chunk.small.blocks[block-1]
-                            )
-                            }
-                            size += 1
-                        }
-                    }
-                }
-            case 2:
-                for forward in 0..<CS {
-                    bits_idx := forward*CS
-                    bits_forward_idx := (forward+1)*CS
-
-                    for right in 0..<CS {
-                        bits_here := face_masks[face][right + bits_idx]
-                        if bits_here == 0 do continue
-
-                        bits_forward := face_masks[face][right + bits_forward_idx] if forward < CS-1 else 0
-                        bits_right   := face_masks[face][right+1 + bits_idx]       if right   < CS-1 else 0
-                        rightCS := right * CS
-
-                        for bits_here > 0 {
-                            bit_pos := u8(bits.trailing_zeros(bits_here))
-                            
-                            bits_here &= ~(1 << bit_pos)
-                            if bit_pos == 0 do continue
-
-
-                            block := blocks[get_axis_idx(axis, right+1, forward+1, bit_pos)]
-                            forward_merged_ref := &forward_merged[rightCS + int(bit_pos) - 1]
-                            right_merged_ref := &right_merged[bit_pos - 1]
-
-                            if (
-                                (right_merged_ref^ == 0) &&
-                                (bits_forward >> bit_pos & 1 != 0) &&
-                                (block == blocks[get_axis_idx(axis, right+1, forward+2, bit_pos)]) \
-                            ) {
-                                forward_merged_ref^ += 1
-                                continue
-                            }
-
-                            if (
-                                (bits_right >> bit_pos & 1 != 0) &&
-                                (forward_merged_ref^ == forward_merged[(rightCS+CS) + int(bit_pos) - 1]) &&
-                                (block == blocks[get_axis_idx(axis, right+2, forward+1, bit_pos)]) \ 
-                            ) {
-                                forward_merged_ref^ = 0
-                                right_merged_ref^ += 1
-                                continue
-                            }
-
-                            mesh_left   := u8(right) - right_merged_ref^
-                            mesh_front  := u8(forward) - forward_merged_ref^
-                            mesh_up     := u8(bit_pos) - 1 + u8(~face_casted & 1)
-
-                            mesh_width  := right_merged_ref^ + 1
-                            mesh_length := forward_merged_ref^ + 1
-
-                            forward_merged_ref^ = 0
-                            right_merged_ref^ = 0
-
-                            vertex_data[size] = create_mesh_data(
-                                pos_x   = mesh_left + (face_casted==4 ? mesh_width : 0),
-                                pos_y   = mesh_front,
-                                pos_z   = mesh_up,
-                                size_u  = mesh_width,
-                                size_v  = mesh_length,
-                                face    = face_casted,
-                                texture = chunk.small.blocks[block-1]
-                            )
-                            size += 1
-                        }
-                    }
-                }
-            }
-        }
+    for mesh in _free_meshes {
+        delete(mesh.data)
+        free(mesh)
     }
-    return vertex_data, size
+    delete(_free_meshes)
+    _free_meshes = nil
+    utils.destroy(&_meshes_ready)
 }
 
-edit_mesh::proc(pos: ChunkPos, data: []BlockVertData, size: u32) {
-    // utils.bench("edit_mesh")
+@(private="file")
+render_deactivate_chunk::proc(pos: ChunkPos) {
     using _block_mesh.bufs
 
-    ssbo_data : [4]i32
-    ssbo_data.xyz = pos
-    ssbo_data.w = 0
+    delete_key(&_last_meshed, pos)
+    delete_key(&_mesh_generations, pos) // drops any mesh still in flight
 
-    cmd : ^IndirectCommand
-    exists := false
-    idx := 0
+    i, ok := _draw_slots[pos]
+    if !ok do return
+    delete_key(&_draw_slots, pos)
 
-    for e, i in ssb.buffer {
-        if e.xyz == pos {
-            exists = true
-            idx = i
-            break
-        }
-    }
-
-    // create if it doesn't exist
-    if !exists {
-        cmd, idx = create_indirect_command(size)
-        inject_at(&ssb.buffer, idx, ssbo_data)
+    utils.free_range(&attrib.ranges, indirect.ranges[i])
 
-    // resize and/or move if it does
-    } else {
-        idx_new : int
-        cmd, idx_new = resize_indirect_command(&indirect.buffer[idx], size)
-        if idx_new != idx {
-            ordered_remove(&ssb.buffer, idx)
-            inject_at(&ssb.buffer, idx_new, ssbo_data)
-        }
-    }
-
-    if attrib.size > len(attrib.buffer) {
-        resize(&attrib.buffer, attrib.size + 1024)
+    // the last draw takes its place, draw order doesn't matter
+    unordered_remove(&indirect.buffer, i)
+    unordered_remove(&indirect.ranges, i)
+    unordered_remove(&ssb.buffer, i)
+    if i < len(ssb.buffer) {
+        _draw_slots[ssb.buffer[i].xyz] = i
+        mark_dirty(&indirect.gpu, i, i + 1)
+        mark_dirty(&ssb.gpu, i, i + 1)
     }
-
-    // despacito
-    fmt.print("size:", size, "idx:", idx, "cmd:", cmd, "idx:", idx, "attrib.size:", attrib.size, "len(attrib.buffer):", len(attrib.buffer), "\n")
-    copy(attrib.buffer[cmd.base_instance:], data[:size])
 }
 
-create_indirect_command::proc(size: u32) -> (cmd: ^IndirectCommand, idx: int) {
+edit_mesh::proc(pos: ChunkPos, data: []BlockVertData, size: u32) {
     using _block_mesh.bufs
 
-    command := IndirectCommand{
-        count = 0,
-        instance_count = size,
-        first = 0,
-        base_instance = 0, // we'll find the right place later
-    }
-
-    // check if empty. this might seem redundant, but it prevents a crash
-    if len(indirect.buffer) == 0 {
-        attrib.size = int(size)
-        append(&indirect.buffer, command)
-        cmd = &indirect.buffer[0]
-        idx = 0
-        return
-    }
-
-    // check the start
-    if indirect.buffer[0].base_instance >= size {
-        inject_at(&indirect.buffer, 0, command)
-        cmd = &indirect.buffer[0]
-        idx = 0
-        return
+    idx, exists := _draw_slots[pos]
+    if !exists {
+        handle, offset := utils.alloc_range(&attrib.ranges, size)
+        append(&indirect.buffer, IndirectCommand{
+            count = 4, // one quad per instance
+            instance_count = size,
+            first = 0,
+            base_instance = offset,
+        })
+        append(&indirect.ranges, handle)
+        append(&ssb.buffer, [4]i32{pos.x, pos.y, pos.z, 0})
+        idx = len(indirect.buffer) - 1
+        _draw_slots[pos] = idx
+        mark_dirty(&ssb.gpu, idx, idx + 1)
+    } else {
+        // the old data gets overwritten anyway, so moving doesn't need a copy
+        handle, offset, _ := utils.resize_range(&attrib.ranges, indirect.ranges[idx], size)
+        indirect.ranges[idx] = handle
+        indirect.buffer[idx].instance_count = size
+        indirect.buffer[idx].base_instance = offset
     }
 
-    // check for any other gaps
-    for i in 1..<len(indirect.buffer) {        
-        prev_end := (indirect.buffer[i-1].base_instance + indirect.buffer[i-1].instance_count)
-        cur_start := indirect.buffer[i].base_instance
-
-        if (cur_start - prev_end >= size ) {
-            cmd.base_instance = prev_end
-            inject_at(&indirect.buffer, i, command)
-            cmd = &indirect.buffer[i]
-            idx = i
-            return
-        }
-    }
+    attrib.size = int(attrib.ranges.capacity)
+    if attrib.size > len(attrib.buffer) do resize(&attrib.buffer, attrib.size)
 
-    // if no gaps, put to the end
-    last := indirect.buffer[len(indirect.buffer)-1]
-    command.base_instance = last.base_instance + last.instance_count
-    attrib.size = int(command.base_instance + size)
-    append(&indirect.buffer, command)
-    cmd = &indirect.buffer[len(indirect.buffer)-1]
-    idx = len(indirect.buffer)-1
-    return
+    offset := int(indirect.buffer[idx].base_instance)
+    copy(attrib.buffer[offset:], data[:size])
+    mark_dirty(&attrib.gpu, offset, offset + int(size))
+    mark_dirty(&indirect.gpu, idx, idx + 1)
 }
 
-resize_indirect_command::proc(cmd: ^IndirectCommand, new_size: u32) -> (cmd_new:^IndirectCommand, idx_new: int) {
+// Slides every chunk's instances to the front of the buffer once enough
+// of it is lost to holes. Cheap enough to run every now and then, since
+// it's a few memmoves followed by the upload we'd do anyway.
+@(private="file")
+compact_instance_buffer::proc() {
     using _block_mesh.bufs
+    @(static) moves : [dynamic]utils.RangeMove
 
-    // get index with pointer arithmetic
-    idx_old, has := utils.index_of(&indirect.buffer, cmd)
-    if !has {
-        utils.log(.ERROR, "resize_indirect_command: command not found. idx_old:", idx_old, "new_size:", new_size)
-        return
-    }
-
-    // if we're shrinking, we don't need to do anything
-    if cmd.instance_count >= new_size {
-        cmd.instance_count = new_size
-        cmd_new = cmd
-        idx_new = idx_old
-        return
-    }
+    utils.compact_ranges(&attrib.ranges, &moves)
+    if len(moves) == 0 do return
 
-    // if it's at the end, we might need to increase our buffer size
-    if idx_old == len(indirect.buffer)-1 {
-        attrib.size =  max(attrib.size, int(cmd.base_instance + new_size))
-        cmd.instance_count = new_size
-        cmd_new = cmd
-        idx_new = idx_old
-        return
+    for move in moves {
+        copy(attrib.buffer[move.to:move.to + move.size], attrib.buffer[move.from:move.from + move.size])
+        mark_dirty(&attrib.gpu, move.to, move.to + move.size)
     }
-
-    // the last check should prevent us from going out of bounds here
-    next := indirect.buffer[idx_old+1]
-
-    // if we can expand, we do
-    if cmd.base_instance + new_size <= next.base_instance {
-        cmd.instance_count = new_size
-        cmd_new = cmd
-        idx_new = idx_old
-        return
+    for handle, i in indirect.ranges {
+        indirect.buffer[i].base_instance = utils.range_offset(&attrib.ranges, handle)
     }
+    mark_dirty(&indirect.gpu, 0, len(indirect.buffer))
+}
 
-    // if we can't, we find a new place for it
-    ordered_remove(&indirect.buffer, idx_old)
-    cmd_new, idx_new = create_indirect_command(new_size)
-    return
-}
\ No newline at end of file
+get_instance_buffer_stats::proc() -> utils.RangeStats {
+    return utils.range_allocator_stats(&_block_mesh.bufs.attrib.ranges)
+}
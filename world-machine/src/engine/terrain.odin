@@ -0,0 +1,226 @@
+package engine
+
+import "core:math"
+import "core:time"
+import "core:sync"
+
+import "src:utils"
+
+TERRAIN_OCTAVES :: 5
+TERRAIN_BASE :: f32(0)          // height the noise is centered around
+TERRAIN_AMPLITUDE :: f32(48)    // how far above and below it the terrain goes
+TERRAIN_LACUNARITY :: f32(2)
+TERRAIN_PERSISTENCE :: f32(0.5)
+
+BIOME_SCALE :: f32(8) // biomes change this many times slower than the terrain
+
+COLUMNS_PER_CHUNK :: 16*16
+
+// Only block there is for now
+@(private="file") DEFAULT_BLOCK :: BlockID(1)
+
+// World space surface height of every column in a chunk, indexed x + z*16.
+Heightmap::[COLUMNS_PER_CHUNK]i32
+
+// Everything generation needs to know about a chunk column, shared by
+// every chunk stacked in it.
+ColumnData::struct {
+    heights: Heightmap,
+    biomes: [COLUMNS_PER_CHUNK]u8,
+    surface: [COLUMNS_PER_CHUNK]BlockID,
+}
+
+// Ring of chunk columns, indexed by their x and z masked to the ring size.
+// The ring is wider than the view, so a slot only gets reused once the
+// player has moved far enough that the column in it is out of range.
+ColumnCache::struct {
+    slots: []ColumnSlot,
+    bits: u32,
+    mask: i32,
+    hits, misses: int,
+}
+
+ColumnSlot::struct {
+    lock: sync.Mutex,
+    column: [2]i32,
+    filled: bool,
+    data: ColumnData,
+}
+
+_column_cache : ColumnCache
+
+init_column_cache::proc(cache: ^ColumnCache, radius: i32) {
+    bits := u32(1)
+    for (i32(1) << bits) < 2*radius + 2 do bits += 1
+
+    cache^ = ColumnCache{
+        slots = make([]ColumnSlot, 1 << (2*bits)),
+        bits = bits,
+        mask = (i32(1) << bits) - 1,
+    }
+}
+
+destroy_column_cache::proc(cache: ^ColumnCache) {
+    delete(cache.slots)
+    cache.slots = nil
+}
+
+// Copies the data of `column` into `out`, generating it if nobody has yet.
+// The first chunk of a column to get here pays for the noise, the others
+// just wait for it.
+get_column::proc(cache: ^ColumnCache, column: [2]i32, out: ^ColumnData) {
+    idx := int(column.x & cache.mask) | int(column.y & cache.mask) << cache.bits
+    slot := &cache.slots[idx]
+
+    sync.mutex_lock(&slot.lock)
+    defer sync.mutex_unlock(&slot.lock)
+
+    if slot.filled && slot.column == column {
+        sync.atomic_add(&cache.hits, 1)
+    } else {
+        sync.atomic_add(&cache.misses, 1)
+        generate_column(_noise_seed, column, &slot.data)
+        slot.column = column
+        slot.filled = true
+    }
+    out^ = slot.data
+}
+
+column_cache_hit_rate::proc(cache: ^ColumnCache) -> f64 {
+    hits := f64(sync.atomic_load(&cache.hits))
+    misses := f64(sync.atomic_load(&cache.misses))
+    return hits / max(hits + misses, 1)
+}
+
+generate_column::proc(seed: i64, column: [2]i32, out: ^ColumnData) {
+    generate_heightmap(seed, column, &out.heights)
+
+    // biomes are just another, much lower frequency noise layer for now
+    xs, zs, temperature : [COLUMNS_PER_CHUNK]f32
+    frequency := 1 / (f32(WORLD_HEIGHT) * BIOME_SCALE)
+    for i in 0..<COLUMNS_PER_CHUNK {
+        xs[i] = f32(column.x*16 + i32(i & 15)) * frequency
+        zs[i] = f32(column.y*16 + i32(i >> 4)) * frequency
+    }
+    simplex_2d_batch(~u32(seed), xs[:], zs[:], temperature[:], 1)
+
+    for i in 0..<COLUMNS_PER_CHUNK {
+        out.biomes[i] = u8(clamp((temperature[i] + 1) * 127.5, 0, 255))
+        out.surface[i] = surface_block(out.biomes[i])
+    }
+}
+
+@(private="file")
+surface_block::proc(biome: u8) -> BlockID {
+    // TODO: pick something based on the biome once there's more than one block
+    return DEFAULT_BLOCK
+}
+
+// Computes the heights of the 16x16 columns of the chunk column at `column`
+// (which is a chunk's x and z). All the columns go through the noise
+// together, one octave at a time.
+generate_heightmap::proc(seed: i64, column: [2]i32, out: ^Heightmap) {
+    xs, zs, acc : [COLUMNS_PER_CHUNK]f32
+
+    frequency := 1 / f32(WORLD_HEIGHT)
+    for i in 0..<COLUMNS_PER_CHUNK {
+        xs[i] = f32(column.x*16 + i32(i & 15)) * frequency
+        zs[i] = f32(column.y*16 + i32(i >> 4)) * frequency
+    }
+
+    amplitude := f32(1)
+    total := f32(0)
+    for octave in 0..<TERRAIN_OCTAVES {
+        simplex_2d_batch(u32(seed) + u32(octave) * 0x9E3779B9, xs[:], zs[:], acc[:], amplitude)
+        total += amplitude
+        amplitude *= TERRAIN_PERSISTENCE
+
+        for i in 0..<COLUMNS_PER_CHUNK {
+            xs[i] *= TERRAIN_LACUNARITY
+            zs[i] *= TERRAIN_LACUNARITY
+        }
+    }
+
+    scale := TERRAIN_AMPLITUDE / total
+    for i in 0..<COLUMNS_PER_CHUNK {
+        out[i] = i32(math.floor(TERRAIN_BASE + acc[i] * scale))
+    }
+}
+
+@(private="file") F2 :: f32(0.36602540378) // (sqrt(3) - 1) / 2
+@(private="file") G2 :: f32(0.21132486540) // (3 - sqrt(3)) / 6
+
+@(private="file")
+GRADIENTS_2D := [8][2]f32{
+    { 1,  1}, {-1,  1}, { 1, -1}, {-1, -1},
+    { 1,  0}, {-1,  0}, { 0,  1}, { 0, -1},
+}
+
+// Adds `amplitude * simplex(xs[i], zs[i])` onto `out[i]`. It's one flat loop
+// without branches, so the compiler is free to vectorize it.
+simplex_2d_batch::proc(seed: u32, xs, zs, out: []f32, amplitude: f32) {
+    #no_bounds_check for i in 0..<len(out) {
+        x, y := xs[i], zs[i]
+
+        // skew into simplex space to find the cell we're in
+        s := (x + y) * F2
+        fi := math.floor(x + s)
+        fj := math.floor(y + s)
+        t := (fi + fj) * G2
+        x0 := x - (fi - t)
+        y0 := y - (fj - t)
+
+        // and which of its two triangles
+        i1 := x0 > y0 ? f32(1) : f32(0)
+        j1 := 1 - i1
+
+        x1 := x0 - i1 + G2
+        y1 := y0 - j1 + G2
+        x2 := x0 - 1 + 2*G2
+        y2 := y0 - 1 + 2*G2
+
+        ci := transmute(u32)i32(fi)
+        cj := transmute(u32)i32(fj)
+        g0 := GRADIENTS_2D[hash_2d(seed, ci, cj) & 7]
+        g1 := GRADIENTS_2D[hash_2d(seed, ci + u32(i1), cj + u32(j1)) & 7]
+        g2 := GRADIENTS_2D[hash_2d(seed, ci + 1, cj + 1) & 7]
+
+        n := simplex_corner(x0, y0, g0) + simplex_corner(x1, y1, g1) + simplex_corner(x2, y2, g2)
+        out[i] += amplitude * 70 * n
+    }
+}
+
+@(private="file")
+simplex_corner::#force_inline proc(x, y: f32, g: [2]f32) -> f32 {
+    t := max(0.5 - x*x - y*y, 0)
+    t *= t
+    return t * t * (g.x*x + g.y*y)
+}
+
+@(private="file")
+hash_2d::#force_inline proc(seed, x, y: u32) -> u32 {
+    h := seed ~ (x * 0x27d4eb2d) ~ (y * 0x165667b1)
+    h ~= h >> 15
+    h *= 0x2c1b3c6d
+    h ~= h >> 12
+    h *= 0x297a2d39
+    h ~= h >> 15
+    return h
+}
+
+when utils.ENABLE_BENCHMARKS {
+
+    bench_heightmap::proc() {
+        ITERATIONS :: 4096
+        heights : Heightmap
+
+        start := time.tick_now()
+        for i in 0..<ITERATIONS {
+            generate_heightmap(_noise_seed, {i32(i % 64), i32(i / 64)}, &heights)
+        }
+        seconds := time.duration_seconds(time.tick_since(start))
+
+        utils.log(.BENCHMARK, "heightmap:", f64(ITERATIONS * COLUMNS_PER_CHUNK) / seconds, "columns/sec")
+    }
+
+}
@@ -0,0 +1,96 @@
+package engine
+
+import "base:runtime"
+import "core:testing"
+
+import "src:utils"
+
+@(private="file") TEST_SPREADER :: BlockID(7) // spreads into the air around it
+@(private="file") TEST_TRAIL :: BlockID(8)    // what a spreader leaves behind
+
+// A spreader copies itself into an air block near it, often in the next
+// chunk over, and turns into a trail. If there's no room it tries again
+// later. Picks the spot from its position alone and stays well within
+// TICK_REACH, so it ticks the same way however the ticks are spread out.
+@(private="file")
+test_spread_tick::proc "c" (at: BlockPos, id: BlockID, kind: BlockTickKind) {
+    context = runtime.default_context()
+
+    h := u32(at.x) * 73856093 ~ u32(at.y) * 19349663 ~ u32(at.z) * 83492791 ~ u32(kind)
+    target := at + BlockPos{i32(h % 7) - 3, i32((h >> 3) % 3) - 1, i32((h >> 6) % 7) - 3}
+
+    if get_block(target) == 0 && change_block(target, TEST_SPREADER) {
+        schedule_block_tick(target, 1 + (h >> 9) % 4)
+        change_block(at, TEST_TRAIL)
+    } else {
+        schedule_block_tick(at, 1 + (h >> 12) % 8)
+    }
+}
+
+// Ground up to y = 12, with spreaders scattered through the air above it.
+@(private="file")
+fill_test_layout::proc(pos: ChunkPos, layout: ^ChunkLayout, spreaders: ^[dynamic]BlockPos) {
+    for z in 0..<CS {
+        for x in 0..<CS {
+            for y in 0..<CS {
+                at := pos*CS + BlockPos{i32(x), i32(y), i32(z)}
+                id := BlockID(0)
+                if at.y < 12 {
+                    id = 1
+                } else if (u32(at.x) * 2654435761 ~ u32(at.y) * 40503 ~ u32(at.z) * 2246822519) % 61 == 0 {
+                    id = TEST_SPREADER
+                    append(spreaders, at)
+                }
+                layout[chunk_block_index(x, y, z)] = id
+            }
+        }
+    }
+}
+
+// Runs the same ticks on the same world with and without PARALLEL_TICKS,
+// both have to end up with the same world. The only test that uses the
+// global world, so the others can run next to it.
+@(test)
+test_parallel_ticks_match_serial::proc(t: ^testing.T) {
+    TICKS :: 100
+    size := ChunkPos{4, 2, 4} // in chunks
+
+    utils.init_job_system(&_jobs, 4)
+    defer utils.destroy_job_system(&_jobs)
+
+    parallel := PARALLEL_TICKS
+    defer PARALLEL_TICKS = parallel
+
+    spreaders := make([dynamic]BlockPos)
+    defer delete(spreaders)
+
+    initial : u64
+    hashes : [2]u64
+    for run in 0..<2 {
+        PARALLEL_TICKS = run == 1
+        init_test_world(max(size.x, size.y, size.z))
+        register_tickable_block(TEST_SPREADER, test_spread_tick)
+
+        clear(&spreaders)
+        layout : ChunkLayout
+        for z in 0..<size.z {
+            for y in 0..<size.y {
+                for x in 0..<size.x {
+                    pos := ChunkPos{x, y, z}
+                    fill_test_layout(pos, &layout, &spreaders)
+                    load_test_chunk(pos, layout[:])
+                }
+            }
+        }
+        for at in spreaders do schedule_block_tick(at, 1)
+        initial = world_hash()
+
+        for _ in 0..<TICKS do tick()
+        hashes[run] = world_hash()
+        destroy_test_world()
+    }
+
+    testing.expect(t, len(spreaders) > 0, "the test world has nothing that ticks")
+    testing.expect(t, hashes[0] != initial, "the ticks didn't change anything")
+    testing.expectf(t, hashes[0] == hashes[1], "serial ticks ended up with %x, parallel ones with %x", hashes[0], hashes[1])
+}
@@ -1,5 +1,9 @@
 package engine
 
+import "base:runtime"
+
+import "core:sync"
+import "core:thread"
 import "core:time"
 
 import "src:utils"
@@ -7,24 +11,119 @@ import "src:utils"
 TICKS_PER_SECOND :: 20
 TICK_RATE :: time.Second / TICKS_PER_SECOND
 
-@(private="file") _tick_desync := time.Duration(0)
+// How far behind the ticks can fall before they stop trying to catch up.
+// Whatever is missed beyond this is skipped and counted.
+MAX_CATCHUP_TICKS :: 5
+
+// The futex sleep wakes up this early, the rest is waited out by yielding,
+// since the OS tends to oversleep by about a millisecond.
+@(private="file") TICK_SPIN_MARGIN :: time.Millisecond
+
+TickStats::struct {
+    ticks: u64,
+    last_duration: time.Duration,
+    mean_duration: time.Duration, // over the last second or so
+    max_duration: time.Duration,  // since the start
+    overruns: u64, // ticks that took longer than TICK_RATE
+    skipped: u64,  // ticks dropped because we fell too far behind
+}
+
+@(private="file") _tick_stats : TickStats
+@(private="file") _tick_stats_lock : sync.Mutex
+
+// Only used to wake the tick thread up early when it's time to stop.
+@(private="file") _tick_futex := sync.Futex(0)
 
+// Ticks happen on a fixed schedule off the monotonic clock. A tick that runs
+// late doesn't move the schedule, the ones after it run back to back until
+// they're caught up.
 tick_loop::proc() {
-    for world_should_tick() {
-        _tick_desync += last_frame_time()
-        if _tick_desync >= TICK_RATE {
-            _tick_desync -= TICK_RATE
-
-            utils.emit_engine_signal(.TICK_START)
-            tick()
-            utils.emit_engine_signal(.TICK_END)
+    next_tick := time.tick_now()
+
+    for sync.atomic_load(&_world_should_tick) {
+        now := time.tick_now()
+        if wait := time.tick_diff(now, next_tick); wait > 0 {
+            sleep_until(next_tick)
+            continue
         }
 
-        time.sleep(time.Millisecond)
+        behind := int(time.tick_diff(next_tick, now) / TICK_RATE)
+        if behind > MAX_CATCHUP_TICKS {
+            // give up on what we can't make up, the schedule starts over from now
+            record_skipped_ticks(u64(behind - MAX_CATCHUP_TICKS))
+            next_tick = time.tick_add(now, -MAX_CATCHUP_TICKS * TICK_RATE)
+        }
+
+        start := time.tick_now()
+        utils.emit_engine_signal(.TICK_START)
+        tick()
+        utils.emit_engine_signal(.TICK_END)
+        flush_block_edits()
+        record_tick(time.tick_since(start))
+
+        next_tick = time.tick_add(next_tick, TICK_RATE)
     }
 }
 
+// Stops the tick loop and waits for the tick in progress, if any.
+stop_tick_loop::proc() {
+    sync.atomic_store(&_world_should_tick, false)
+    sync.atomic_store(&_tick_futex, 1)
+    sync.futex_signal(&_tick_futex)
+    thread.join(_ticks_thread)
+}
+
+get_tick_stats::proc() -> TickStats {
+    sync.mutex_lock(&_tick_stats_lock)
+    defer sync.mutex_unlock(&_tick_stats_lock)
+    return _tick_stats
+}
+
 @(private="file")
+sleep_until::proc(deadline: time.Tick) {
+    if wait := time.tick_diff(time.tick_now(), deadline); wait > TICK_SPIN_MARGIN {
+        sync.futex_wait_with_timeout(&_tick_futex, 0, wait - TICK_SPIN_MARGIN)
+    }
+    for time.tick_diff(time.tick_now(), deadline) > 0 && sync.atomic_load(&_world_should_tick) {
+        thread.yield()
+    }
+}
+
+@(private="file")
+record_tick::proc(duration: time.Duration) {
+    sync.mutex_lock(&_tick_stats_lock)
+    defer sync.mutex_unlock(&_tick_stats_lock)
+
+    s := &_tick_stats
+    s.ticks += 1
+    s.last_duration = duration
+    s.max_duration = max(s.max_duration, duration)
+    if duration > TICK_RATE do s.overruns += 1
+
+    // moving average over roughly one second of ticks
+    s.mean_duration += (duration - s.mean_duration) / TICKS_PER_SECOND
+}
+
+@(private="file")
+record_skipped_ticks::proc(count: u64) {
+    sync.mutex_lock(&_tick_stats_lock)
+    _tick_stats.skipped += count
+    sync.mutex_unlock(&_tick_stats_lock)
+
+    utils.log(.WARNING, "Ticks are running behind, skipped", count)
+}
+
+@(private)
 tick::proc() {
     utils.bench("tick")
+    // whatever the handlers leave in the temp allocator
+    runtime.DEFAULT_TEMP_ALLOCATOR_TEMP_GUARD()
+
+    // picked up front, so what the scheduled ticks do can't change the sample
+    scheduled, random := collect_block_ticks()
+
+    // the signals double as barriers between the phases
+    run_block_ticks(scheduled, .SCHEDULED)
+    utils.emit_engine_signal(.TICK_MIDDLE)
+    run_block_ticks(random, .RANDOM)
 }
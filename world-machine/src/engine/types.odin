@@ -31,6 +31,9 @@ Range::struct($T:typeid) {
     min, max : T,
 }
 
+// A box of blocks, both corners included.
+BlockBox::Range(BlockPos)
+
 IndirectCommand::struct {
     count:          u32,
     instance_count: u32,
@@ -45,23 +48,13 @@ Block::struct {
     tooltip:    string,
 }
 
-SmallChunk::struct {
-    data:   [16*16*16]u8,
-    blocks: [dynamic]BlockID,
-}
-
-LargeChunk::struct {
-    data: [16*16*16]BlockID,
-}
-
 ChunkBitMask::[16*16]u16
 
-// This is the main chunk struct. Small chunks are used when the chunk has
-// less than 256 unique blocks. Use dedicated functions to modify the chunk.
+// This is the main chunk struct. Blocks are palette compressed, see
+// `BlockStorage`. Use dedicated functions to modify the chunk.
 // Do not modify the chunk directly, you're probably going to mess it up.
 Chunk::struct { // yxz
-    small:      ^SmallChunk,
-    large:      ^LargeChunk,
+    blocks:     ^BlockStorage,
     cull_mask:  ^ChunkBitMask,
 }
 
@@ -127,6 +120,19 @@ ApiFunctions::struct {
     add_block:      proc "c" (block: InitBlockInfo),
     add_entity:     proc "c" (entity: InitEntityInfo),
     add_item:       proc "c" (item: InitItemInfo),
+
+    // world edits, the bulk ones return how many chunks they changed
+    get_block:      proc "c" (at: BlockPos) -> BlockID,
+    change_block:   proc "c" (at: BlockPos, to: BlockID) -> bool,
+    fill_blocks:    proc "c" (box: BlockBox, id: BlockID) -> i32,
+    replace_blocks: proc "c" (box: BlockBox, from, to: BlockID) -> i32,
+    copy_blocks:    proc "c" (box: BlockBox, size: ^[3]i32) -> [^]BlockID, // laid out like `Prefab`, give it back to `free_copied_blocks`
+    free_copied_blocks: proc "c" (blocks: [^]BlockID),
+    paste_blocks:   proc "c" (blocks: [^]BlockID, size: [3]i32, at: BlockPos, skip_air: bool) -> i32, // laid out like `Prefab`
+
+    // block ticks, register from `init_blocks`
+    register_tickable_block: proc "c" (id: BlockID, handler: BlockTickProc),
+    schedule_block_tick:     proc "c" (at: BlockPos, delay: u32),
 }
 
 ModInfo::struct {
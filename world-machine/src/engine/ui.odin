@@ -2,6 +2,7 @@ package engine
 
 import "core:fmt"
 import "core:strings"
+import "core:time"
 
 import "extra-vendor:imgui"
 import impl_sdl "extra-vendor:imgui/imgui_impl_sdl2"
@@ -52,6 +53,34 @@ draw_debug_window::proc() {
     strings.builder_reset(&sb)
     imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "yaw:%f pitch:%f%c", _camera.yaw, _camera.pitch, byte(0))))
     strings.builder_reset(&sb)
+    imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "uploaded:%dKB%c", get_uploaded_bytes() / 1024, byte(0))))
+    strings.builder_reset(&sb)
+    imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "chunk memory:%dKB%c", loaded_chunk_memory() / 1024, byte(0))))
+    strings.builder_reset(&sb)
+    instances := get_instance_buffer_stats()
+    imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "instance buffer:%d/%d fragmentation:%.2f%c", instances.used, instances.capacity, instances.fragmentation, byte(0))))
+    strings.builder_reset(&sb)
+    ticks := get_tick_stats()
+    imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "tick:%.2fms max:%.2fms overruns:%d skipped:%d%c", time.duration_milliseconds(ticks.mean_duration), time.duration_milliseconds(ticks.max_duration), ticks.overruns, ticks.skipped, byte(0))))
+    strings.builder_reset(&sb)
+    io := get_chunk_io_stats()
+    imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "chunk io: %d queued, %dKB/s%c", io.queued_writes, io.bytes_per_second / 1024, byte(0))))
+    strings.builder_reset(&sb)
+    imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "column cache hits:%.1f%%%c", column_cache_hit_rate(&_column_cache) * 100, byte(0))))
+    strings.builder_reset(&sb)
+    when utils.ENABLE_BENCHMARKS {
+        if frame, ok := utils.get_scope_stats("main_loop", "main_loop"); ok {
+            imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "frame avg:%.2fms p99:%.2fms%c", time.duration_milliseconds(frame.avg), time.duration_milliseconds(frame.p99), byte(0))))
+            strings.builder_reset(&sb)
+        }
+        if tick, ok := utils.get_scope_stats("tick", "tick"); ok {
+            imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "tick avg:%.2fms p99:%.2fms%c", time.duration_milliseconds(tick.avg), time.duration_milliseconds(tick.p99), byte(0))))
+            strings.builder_reset(&sb)
+        }
+    }
+    cull := get_cull_stats()
+    imgui.Text(strings.unsafe_string_to_cstring(fmt.sbprintf(&sb, "chunks:%d/%d faces:%d/%d%c", cull.chunks_visible, cull.chunks_total, cull.instances_visible, cull.instances_total, byte(0))))
+    strings.builder_reset(&sb)
     imgui.End()
 }
 
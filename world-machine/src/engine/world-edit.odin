@@ -0,0 +1,281 @@
+package engine
+
+import "base:runtime"
+
+import "core:math/linalg"
+import "core:slice"
+import "core:sync"
+
+import "src:utils"
+
+// Edits that cover a lot of blocks at once. The box is cut up into chunks
+// and each chunk is edited by its own job: decoded once, changed, packed
+// again and re-meshed once like any other edit (see `flush_block_edits`).
+// Chunks that aren't loaded are skipped. These return once every chunk is
+// done and, like `change_block`, can't be called while holding the chunk
+// store read lock.
+
+// A copied piece of the world, laid out yxz like a chunk.
+Prefab::struct {
+    size: [3]i32,
+    blocks: []BlockID,
+}
+
+@(private="file")
+BulkEditKind::enum {
+    FILL,
+    REPLACE,
+    PASTE,
+    COPY, // the only one that doesn't change anything
+}
+
+@(private="file")
+BulkEdit::struct {
+    kind: BulkEditKind,
+    box: BlockBox,
+    from, to: BlockID,
+    prefab: ^Prefab, // what gets pasted, or where the copy goes
+    skip_air: bool,
+    chunks_changed: i32,
+}
+
+@(private="file")
+BulkEditJob::struct {
+    edit: ^BulkEdit,
+    chunk: ChunkPos,
+}
+
+fill_blocks::proc(box: BlockBox, id: BlockID) -> (chunks_changed: int) {
+    edit := BulkEdit{kind = .FILL, box = normalize_box(box), to = id}
+    return run_bulk_edit(&edit)
+}
+
+replace_blocks::proc(box: BlockBox, from, to: BlockID) -> (chunks_changed: int) {
+    if from == to do return 0
+    edit := BulkEdit{kind = .REPLACE, box = normalize_box(box), from = from, to = to}
+    return run_bulk_edit(&edit)
+}
+
+// Blocks in chunks that aren't loaded come out as air.
+copy_blocks::proc(box: BlockBox, allocator := context.allocator) -> (prefab: Prefab) {
+    box := normalize_box(box)
+    prefab.size = box.max - box.min + 1
+    prefab.blocks = make([]BlockID, prefab.size.x * prefab.size.y * prefab.size.z, allocator)
+
+    edit := BulkEdit{kind = .COPY, box = box, prefab = &prefab}
+    run_bulk_edit(&edit)
+    return prefab
+}
+
+// Stamps the prefab with its lowest corner at `at`. Air in the prefab
+// leaves the world alone, unless `skip_air` is false.
+paste_blocks::proc(prefab: ^Prefab, at: BlockPos, skip_air := true) -> (chunks_changed: int) {
+    edit := BulkEdit{kind = .PASTE, box = {at, at + prefab.size - 1}, prefab = prefab, skip_air = skip_air}
+    return run_bulk_edit(&edit)
+}
+
+destroy_prefab::proc(prefab: ^Prefab) {
+    delete(prefab.blocks)
+    prefab^ = {}
+}
+
+prefab_index::#force_inline proc(prefab: ^Prefab, p: [3]i32) -> int {
+    return int(p.y + p.x*prefab.size.y + p.z*prefab.size.x*prefab.size.y)
+}
+
+@(private="file")
+normalize_box::proc(box: BlockBox) -> BlockBox {
+    return {linalg.min(box.min, box.max), linalg.max(box.min, box.max)}
+}
+
+@(private="file")
+run_bulk_edit::proc(edit: ^BulkEdit) -> (chunks_changed: int) {
+    lo, _ := world_to_chunk_space(edit.box.min)
+    hi, _ := world_to_chunk_space(edit.box.max)
+
+    group : utils.JobGroup
+    jobs := make([dynamic]utils.Job)
+    defer delete(jobs)
+
+    for z := lo.z; z <= hi.z; z += 1 {
+        for y := lo.y; y <= hi.y; y += 1 {
+            for x := lo.x; x <= hi.x; x += 1 {
+                pos := ChunkPos{x, y, z}
+                if !chunk_store_has(&_chunk_store, pos) do continue
+                append(&jobs, utils.make_job(bulk_edit_job, BulkEditJob{edit, pos}, &group))
+            }
+        }
+    }
+
+    utils.submit_batch(&_jobs, jobs[:])
+    utils.wait_for_group(&_jobs, &group)
+    return int(edit.chunks_changed)
+}
+
+@(private="file")
+bulk_edit_job::proc(payload: ^BulkEditJob) {
+    edit, pos := payload.edit, payload.chunk
+    origin := pos * 16
+
+    // the part of the box inside this chunk, in chunk space
+    lo := linalg.max(edit.box.min - origin, BlockPos{0, 0, 0})
+    hi := linalg.min(edit.box.max - origin, BlockPos{15, 15, 15})
+
+    blocks : ChunkBlocks
+
+    if edit.kind == .COPY {
+        chunk_store_read_lock(&_chunk_store)
+        chunk, ok := chunk_store_get(&_chunk_store, pos)
+        if ok {
+            chunk_store_lock_blocks(&_chunk_store, pos)
+            block_storage_decode(chunk.blocks, blocks[:])
+            chunk_store_unlock_blocks(&_chunk_store, pos)
+        }
+        chunk_store_read_unlock(&_chunk_store)
+        if !ok do return
+
+        // every job writes its own part of the prefab
+        for z in lo.z..=hi.z {
+            for x in lo.x..=hi.x {
+                for y in lo.y..=hi.y {
+                    p := origin + BlockPos{x, y, z} - edit.box.min
+                    edit.prefab.blocks[prefab_index(edit.prefab, p)] = blocks[chunk_block_index(x, y, z)]
+                }
+            }
+        }
+        return
+    }
+
+    chunk, ok := chunk_store_begin_edit(&_chunk_store, pos)
+    if !ok do return
+
+    // the palette already tells whether there's anything to do
+    whole_chunk := lo == BlockPos{0, 0, 0} && hi == BlockPos{15, 15, 15}
+    palette := chunk.blocks.palette[:]
+    nothing_to_do := (
+        (edit.kind == .REPLACE && !slice.contains(palette, edit.from)) ||
+        (edit.kind == .FILL && whole_chunk && len(palette) == 1 && palette[0] == edit.to)
+    )
+    if nothing_to_do {
+        chunk_store_end_edit(&_chunk_store, pos)
+        return
+    }
+
+    block_storage_decode(chunk.blocks, blocks[:])
+    changed := false
+    for z in lo.z..=hi.z {
+        for x in lo.x..=hi.x {
+            for y in lo.y..=hi.y {
+                i := chunk_block_index(x, y, z)
+                id := blocks[i]
+
+                switch edit.kind {
+                case .FILL:
+                    id = edit.to
+                case .REPLACE:
+                    if id == edit.from do id = edit.to
+                case .PASTE:
+                    src := edit.prefab.blocks[prefab_index(edit.prefab, origin + BlockPos{x, y, z} - edit.box.min)]
+                    if src != 0 || !edit.skip_air do id = src
+                case .COPY:
+                    unreachable()
+                }
+
+                if id != blocks[i] {
+                    blocks[i] = id
+                    changed = true
+                }
+            }
+        }
+    }
+    if !changed {
+        chunk_store_end_edit(&_chunk_store, pos)
+        return
+    }
+
+    // packing everything again picks the narrowest palette in one go
+    block_storage_fill(chunk.blocks, blocks[:])
+    chunk.blocks.modified = true
+    refresh_active_blocks(pos, chunk.blocks)
+
+    // a fill is the same span of bits in every column
+    span := u16(((u32(2) << u32(hi.y)) - 1) &~ ((u32(1) << u32(lo.y)) - 1))
+    for z in lo.z..=hi.z {
+        for x in lo.x..=hi.x {
+            column := &chunk.cull_mask[x + z*16]
+            if edit.kind == .FILL {
+                if edit.to != 0 {
+                    column^ |= span
+                } else {
+                    column^ &~= span
+                }
+                continue
+            }
+
+            bits := u16(0)
+            for y in 0..<i32(16) {
+                if blocks[chunk_block_index(x, y, z)] != 0 do bits |= 1 << u16(y)
+            }
+            column^ = bits
+        }
+    }
+    chunk_store_end_edit(&_chunk_store, pos)
+
+    mark_chunk_dirty(pos)
+    if lo.x == 0  do mark_chunk_dirty(pos - ChunkPos{1, 0, 0}, false)
+    if hi.x == 15 do mark_chunk_dirty(pos + ChunkPos{1, 0, 0}, false)
+    if lo.y == 0  do mark_chunk_dirty(pos - ChunkPos{0, 1, 0}, false)
+    if hi.y == 15 do mark_chunk_dirty(pos + ChunkPos{0, 1, 0}, false)
+    if lo.z == 0  do mark_chunk_dirty(pos - ChunkPos{0, 0, 1}, false)
+    if hi.z == 15 do mark_chunk_dirty(pos + ChunkPos{0, 0, 1}, false)
+
+    sync.atomic_add(&edit.chunks_changed, 1)
+}
+
+// What mods get through `ApiFunctions`.
+
+@(private)
+api_get_block::proc "c" (at: BlockPos) -> BlockID {
+    context = runtime.default_context()
+    return get_block(at)
+}
+
+@(private)
+api_change_block::proc "c" (at: BlockPos, to: BlockID) -> bool {
+    context = runtime.default_context()
+    return change_block(at, to)
+}
+
+@(private)
+api_fill_blocks::proc "c" (box: BlockBox, id: BlockID) -> i32 {
+    context = runtime.default_context()
+    return i32(fill_blocks(box, id))
+}
+
+@(private)
+api_replace_blocks::proc "c" (box: BlockBox, from, to: BlockID) -> i32 {
+    context = runtime.default_context()
+    return i32(replace_blocks(box, from, to))
+}
+
+@(private)
+api_copy_blocks::proc "c" (box: BlockBox, size: ^[3]i32) -> [^]BlockID {
+    context = runtime.default_context()
+    prefab := copy_blocks(box)
+    size^ = prefab.size
+    return raw_data(prefab.blocks)
+}
+
+// Has to be the same allocator `api_copy_blocks` got, so mods can't just free it themselves.
+@(private)
+api_free_copied_blocks::proc "c" (blocks: [^]BlockID) {
+    context = runtime.default_context()
+    free(blocks)
+}
+
+@(private)
+api_paste_blocks::proc "c" (blocks: [^]BlockID, size: [3]i32, at: BlockPos, skip_air: bool) -> i32 {
+    context = runtime.default_context()
+    prefab := Prefab{size, blocks[:size.x * size.y * size.z]}
+    return i32(paste_blocks(&prefab, at, skip_air))
+}
@@ -1,10 +1,14 @@
 package engine
 
-import "core:math/noise"
 import "core:fmt"
+import "core:hash"
+import "core:mem"
 import "core:math"
 import "core:math/bits"
 import "core:sync"
+import "core:thread"
+import "core:slice"
+import "core:math/linalg"
 
 import "src:utils"
 
@@ -13,17 +17,53 @@ WORLD_HEIGHT := i32(256)
 
 _noise_seed := i64(3169)
 
-_chunks := map[ChunkPos]Chunk{}
+// Written by the job threads, read by everyone else.
+// See chunk-store.odin for the rules.
+_chunk_store : ChunkStore
+
+// Where the world should be loaded around, sent by the main thread.
+LoadCenter::struct {
+    pos: ChunkPos,
+    view_dir: [3]f32, // only used to order chunks at the same distance
+}
 
 // These should only be accesed by the main and world threads.
 // One-to-one queues are only thread safe if there is only one producer and one consumer.
-@(private="file") _chunks_to_generate : utils.OneToOneQueue(ChunkPos)
 @(private="file") _chunks_to_remove : utils.OneToOneQueue(ChunkPos)
-@(private="file") _chunks_to_generate_at : utils.OneToOneQueue(ChunkPos)
+@(private="file") _chunks_to_generate_at : utils.OneToOneQueue(LoadCenter)
+
+// Current center. Written by the world thread, job threads check against
+// it before publishing so nothing that already left the view sneaks back in.
+@(private="file") _center : ChunkPos
+@(private="file") _has_center := false
+@(private="file") _center_lock : sync.Mutex
+
+// Chunks waiting to be handed to the job system, owned by the world thread.
+// Sorted so the most urgent one is at the end.
+@(private="file")
+PendingGeneration::struct {
+    pos: ChunkPos,
+    priority: f32, // lower is more urgent
+}
+@(private="file") _pending_generations : [dynamic]PendingGeneration
 
-@(private="file") _small_chunk_pool : utils.ObjectPool(SmallChunk)
-@(private="file") _large_chunk_pool : utils.ObjectPool(LargeChunk)
+// Only this many chunks per job thread are handed out at once. The rest wait
+// in `_pending_generations`, where they can still be reordered or dropped
+// when the player moves.
+GENERATIONS_IN_FLIGHT_PER_WORKER :: 4
+
+// Pools are shared between the job threads and the world thread.
+@(private="file") _block_storage_pool : utils.ObjectPool(BlockStorage)
 @(private="file") _render_mask_pool : utils.ObjectPool(ChunkBitMask)
+@(private="file") _pool_lock : sync.Mutex
+
+// Chunks that were handed to the job system but haven't been published yet.
+@(private="file") _generations_in_flight := i32(0)
+
+// Where those are, so a chunk that comes back into view while it's still
+// being generated doesn't get generated a second time.
+@(private="file") _positions_in_flight : map[ChunkPos]struct{}
+@(private="file") _in_flight_lock : sync.Mutex
 
 // This is used to signal the world thread that there is work to be done.
 _world_futex := sync.Futex(0)
@@ -31,16 +71,20 @@ _world_futex := sync.Futex(0)
 init_world::proc() {
     utils.bench("init_world")
 
-    _chunks_to_generate = utils.create_one_to_one_queue(ChunkPos)
     _chunks_to_remove = utils.create_one_to_one_queue(ChunkPos)
-    _chunks_to_generate_at = utils.create_one_to_one_queue(ChunkPos)
+    _chunks_to_generate_at = utils.create_one_to_one_queue(LoadCenter)
 
-    _small_chunk_pool = utils.create_pool(SmallChunk, 16)
-    _large_chunk_pool = utils.create_pool(LargeChunk, 16)
+    _block_storage_pool = utils.create_pool(BlockStorage, 16)
     _render_mask_pool = utils.create_pool(ChunkBitMask, 16)
     
-    clear(&_chunks)
-    utils.enqueue(&_chunks_to_generate_at, ChunkPos{0,0,0})
+    init_chunk_store(&_chunk_store, RENDER_DISTANCE)
+    init_column_cache(&_column_cache, RENDER_DISTANCE)
+    init_chunk_io()
+
+    when utils.ENABLE_BENCHMARKS {
+        bench_heightmap()
+    }
+    utils.enqueue(&_chunks_to_generate_at, LoadCenter{})
 
     utils.defer_deinit(deinit_world)
 }
@@ -51,31 +95,51 @@ deinit_world::proc() {
     sync.futex_signal(&_world_futex)
     sync.futex_wait(&_world_loop_running, 1)
 
-    utils.destroy(&_chunks_to_generate)
+    // queued generations bail out early now, we just have to let them drain
+    for sync.atomic_load(&_generations_in_flight) > 0 {
+        if !utils.help(&_jobs) do thread.yield()
+    }
+    wait_for_mesh_jobs()
+
+    // needs the world loaded, which it only surely is by now
+    when utils.ENABLE_BENCHMARKS {
+        bench_raycast()
+    }
+
     utils.destroy(&_chunks_to_remove)
     utils.destroy(&_chunks_to_generate_at)
+    delete(_pending_generations)
+    delete(_positions_in_flight)
 
-    for _, chunk in _chunks {
-        if chunk.small != nil {
-            delete(chunk.small.blocks)
-        }
+    // whatever is still loaded gets saved before it's gone
+    it := make_chunk_store_iterator(&_chunk_store)
+    for chunk, pos in iterate_chunks(&it) {
+        if chunk.blocks.modified do queue_chunk_save(pos, chunk.blocks)
+    }
+    deinit_chunk_io()
+
+    it = make_chunk_store_iterator(&_chunk_store)
+    for chunk in iterate_chunks(&it) {
+        block_storage_destroy(chunk.blocks)
     }
     
-    utils.call_for_all(&_small_chunk_pool, struct{}{}, proc(chunk: ^SmallChunk, _: struct{}) {
-        delete(chunk.blocks)
+    utils.call_for_all(&_block_storage_pool, struct{}{}, proc(blocks: ^BlockStorage, _: struct{}) {
+        block_storage_destroy(blocks)
     })
 
-    utils.destroy(&_small_chunk_pool)
-    utils.destroy(&_large_chunk_pool)
+    utils.destroy(&_block_storage_pool)
     utils.destroy(&_render_mask_pool)
 
-    clear(&_chunks)
+    destroy_chunk_store(&_chunk_store)
+    destroy_column_cache(&_column_cache)
+    delete(_dirty_chunks)
+    destroy_block_ticks()
 }
 
 add_chunk_to_generate::proc(pos: ChunkPos) {
-    utils.enqueue(&_chunks_to_generate, pos)
-    sync.atomic_store(&_world_futex, 1)
-    sync.futex_signal(&_world_futex)
+    if !claim_generation(pos) do return
+    sync.atomic_add(&_generations_in_flight, 1)
+    utils.submit(&_jobs, utils.make_job(generate_chunk_job, pos))
 }
 
 add_chunk_to_remove::proc(pos: ChunkPos) {
@@ -84,38 +148,58 @@ add_chunk_to_remove::proc(pos: ChunkPos) {
     sync.futex_signal(&_world_futex)
 }
 
-add_chunk_to_generate_at::proc(pos: ChunkPos) {
-    utils.enqueue(&_chunks_to_generate_at, pos)
+add_chunk_to_generate_at::proc(pos: ChunkPos, view_dir := [3]f32{}) {
+    utils.enqueue(&_chunks_to_generate_at, LoadCenter{pos, view_dir})
     sync.atomic_store(&_world_futex, 1)
     sync.futex_signal(&_world_futex)
 }
 
+// Called by the main thread every frame, tells the world thread when
+// the camera enters a new chunk.
+update_load_center::proc() {
+    @(static) last_center : ChunkPos
+    @(static) sent_once := false
+
+    center, _ := world_to_chunk_space(Position{
+        f64(_camera.pos.x),
+        f64(_camera.pos.y),
+        f64(_camera.pos.z),
+    })
+    if sent_once && center == last_center do return
+
+    add_chunk_to_generate_at(center, _camera.front)
+    last_center = center
+    sent_once = true
+}
+
 _world_loop_running := sync.Futex(0)
 
+// The world thread decides what to load and unload, the actual generation
+// is done on the job threads.
 world_loop::proc() {
     using utils
 
     sync.atomic_store(&_world_loop_running, 1)
 
     for world_should_update() {
-        for !is_empty(&_chunks_to_generate_at) && _world_should_update {
-            if is_empty(&_chunks_to_generate) && is_empty(&_chunks_to_remove) {
-                pos, _ := dequeue(&_chunks_to_generate_at)
-                queue_generations_at(pos, RENDER_DISTANCE)
+        sync.atomic_store(&_world_futex, 0)
+
+        // only the latest center matters
+        if !is_empty(&_chunks_to_generate_at) {
+            center, _ := dequeue(&_chunks_to_generate_at)
+            for !is_empty(&_chunks_to_generate_at) {
+                center, _ = dequeue(&_chunks_to_generate_at)
             }
-        }
-        for !is_empty(&_chunks_to_generate) && _world_should_update {
-            pos, _ := dequeue(&_chunks_to_generate)
-            generate_chunk(pos)
+            move_center(center, RENDER_DISTANCE)
+            close_far_regions_later(center.pos)
         }
         for !is_empty(&_chunks_to_remove) && _world_should_update {
             pos, _ := dequeue(&_chunks_to_remove)
             remove_chunk(pos)
         }
-        
-        if is_empty(&_chunks_to_generate) && is_empty(&_chunks_to_remove) && is_empty(&_chunks_to_generate_at) {
-            sync.atomic_store(&_world_futex, 0)
-        }
+        submit_pending_generations()
+
+        if !is_empty(&_chunks_to_remove) || !is_empty(&_chunks_to_generate_at) do continue
 
         sync.futex_wait(&_world_futex, 0)
     }
@@ -124,115 +208,329 @@ world_loop::proc() {
     sync.futex_signal(&_world_loop_running)
 }
 
-queue_generations_at::proc(center: ChunkPos, radius: i32) {
-    utils.bench("queue_generations_at")
+@(private="file")
+max_generations_in_flight::proc() -> i32 {
+    return i32(max(len(_jobs.workers), 1) * GENERATIONS_IN_FLIGHT_PER_WORKER)
+}
+
+@(private="file")
+generate_chunk_job::proc(pos: ^ChunkPos) {
+    // skip whatever is still queued when the world shuts down,
+    // or whatever the player walked away from in the meantime
+    if world_should_update() && is_in_view(pos^) do generate_chunk(pos^)
+    // only once it's published, so the world thread finds it in the store
+    finish_generation(pos^)
+
+    // wake the world thread once there's room for more
+    left := sync.atomic_sub(&_generations_in_flight, 1) - 1
+    if left <= max_generations_in_flight() / 2 {
+        sync.atomic_store(&_world_futex, 1)
+        sync.futex_signal(&_world_futex)
+    }
+}
+
+// False if the chunk is already being generated.
+@(private="file")
+claim_generation::proc(pos: ChunkPos) -> bool {
+    sync.mutex_lock(&_in_flight_lock)
+    defer sync.mutex_unlock(&_in_flight_lock)
+
+    if pos in _positions_in_flight do return false
+    _positions_in_flight[pos] = {}
+    return true
+}
+
+@(private="file")
+finish_generation::proc(pos: ChunkPos) {
+    sync.mutex_lock(&_in_flight_lock)
+    delete_key(&_positions_in_flight, pos)
+    sync.mutex_unlock(&_in_flight_lock)
+}
+
+@(private="file")
+is_in_view::proc(pos: ChunkPos) -> bool {
+    sync.mutex_lock(&_center_lock)
+    defer sync.mutex_unlock(&_center_lock)
+    return _has_center && is_in_cube(pos, _center, RENDER_DISTANCE)
+}
+
+@(private="file")
+is_in_cube::#force_inline proc(pos, center: ChunkPos, radius: i32) -> bool {
+    return (
+        abs(pos.x - center.x) <= radius &&
+        abs(pos.y - center.y) <= radius &&
+        abs(pos.z - center.z) <= radius
+    )
+}
+
+// Unloads whatever left the view, queues whatever entered it and
+// reorders everything that's still waiting around the new center.
+move_center::proc(center: LoadCenter, radius: i32) {
+    utils.bench("move_center")
+
+    sync.mutex_lock(&_center_lock)
+    old, had_center := _center, _has_center
+    _center = center.pos
+    _has_center = true
+    sync.mutex_unlock(&_center_lock)
+
+    entered := make([dynamic]ChunkPos, context.temp_allocator)
+    defer free_all(context.temp_allocator)
 
-    Curry::struct {
-        center: ChunkPos,
-        radius: i32,
+    if had_center {
+        if old == center.pos && len(_pending_generations) == 0 do return
+        prefetch_ahead(old, center.pos)
+
+        exited := make([dynamic]ChunkPos, context.temp_allocator)
+        cube_difference(center.pos, old, radius, &exited)
+        for pos in exited {
+            remove_chunk(pos)
+        }
+        cube_difference(old, center.pos, radius, &entered)
+    } else {
+        // nothing loaded yet, so the whole cube is new
+        far_away := ChunkPos{center.pos.x + 2*radius + 1, center.pos.y, center.pos.z}
+        cube_difference(far_away, center.pos, radius, &entered)
     }
 
-    utils.delete_key_if(&_chunks, Curry{center, radius}, proc(pos: ChunkPos, chunk: Chunk, curry:Curry) -> bool {
-        if bool(
-            abs(pos.x - curry.center.x) > curry.radius ||
-            abs(pos.y - curry.center.y) > curry.radius ||
-            abs(pos.z - curry.center.z) > curry.radius
-        ) {
-            utils.enqueue(&_chunks_to_remove, pos)
-            return true
+    // drop what's out of range now, then rank everything again
+    kept := 0
+    for pending in _pending_generations {
+        if !is_in_cube(pending.pos, center.pos, radius) do continue
+        _pending_generations[kept] = PendingGeneration{
+            pos = pending.pos,
+            priority = generation_priority(pending.pos, center),
         }
-        return false
+        kept += 1
+    }
+    resize(&_pending_generations, kept)
+
+    for pos in entered {
+        append(&_pending_generations, PendingGeneration{
+            pos = pos,
+            priority = generation_priority(pos, center),
+        })
+    }
+
+    slice.sort_by(_pending_generations[:], proc(a, b: PendingGeneration) -> bool {
+        return a.priority > b.priority
     })
+}
+
+// Distance decides, the view direction only breaks ties between
+// chunks that are equally far away.
+@(private="file")
+generation_priority::proc(pos: ChunkPos, center: LoadCenter) -> f32 {
+    d := pos - center.pos
+    offset := [3]f32{f32(d.x), f32(d.y), f32(d.z)}
+    dist2 := linalg.dot(offset, offset)
+    if dist2 == 0 do return 0
+
+    facing := linalg.dot(offset, center.view_dir) / math.sqrt(dist2)
+    return dist2 - 0.49 * facing
+}
 
-    for x := -radius; x <= radius; x += 1 {
-        for y := -radius; y <= radius; y += 1 {
-            for z := -radius; z <= radius; z += 1 {
-                pos := ChunkPos{
-                    center.x + x,
-                    center.y + y,
-                    center.z + z,
+// Appends every position of the cube around `to` that isn't in the cube
+// around `from`. Only walks the slabs that stick out, not the whole cube.
+cube_difference::proc(from, to: ChunkPos, radius: i32, out: ^[dynamic]ChunkPos) {
+    for x := to.x - radius; x <= to.x + radius; x += 1 {
+        x_inside := abs(x - from.x) <= radius
+        for y := to.y - radius; y <= to.y + radius; y += 1 {
+            if x_inside && abs(y - from.y) <= radius {
+                // only the ends of this row can stick out
+                for z := to.z - radius; z <= min(from.z - radius - 1, to.z + radius); z += 1 {
+                    append(out, ChunkPos{x, y, z})
+                }
+                for z := max(from.z + radius + 1, to.z - radius); z <= to.z + radius; z += 1 {
+                    append(out, ChunkPos{x, y, z})
                 }
-                _, has := _chunks[pos]
-                if !has {
-                    utils.enqueue(&_chunks_to_generate, pos)
+            } else {
+                for z := to.z - radius; z <= to.z + radius; z += 1 {
+                    append(out, ChunkPos{x, y, z})
                 }
             }
         }
     }
 }
 
+// Hands the most urgent pending chunks to the job system, up to the limit.
+@(private="file")
+submit_pending_generations::proc() {
+    budget := max_generations_in_flight() - sync.atomic_load(&_generations_in_flight)
+    if budget <= 0 || len(_pending_generations) == 0 do return
+
+    jobs := make([dynamic]utils.Job, 0, int(budget), context.temp_allocator)
+    defer free_all(context.temp_allocator)
+
+    // the job for a chunk that's still in flight may skip it, if it started
+    // while the chunk was out of view, so those have to wait their turn
+    busy := make([dynamic]PendingGeneration, context.temp_allocator)
+
+    for i32(len(jobs)) < budget && len(_pending_generations) > 0 {
+        pending := pop(&_pending_generations)
+        if chunk_store_has(&_chunk_store, pending.pos) do continue
+        if !claim_generation(pending.pos) {
+            append(&busy, pending)
+            continue
+        }
+        append(&jobs, utils.make_job(generate_chunk_job, pending.pos))
+    }
+    #reverse for pending in busy do append(&_pending_generations, pending)
+
+    // everything goes in as one batch, so the job threads are only woken up once
+    sync.atomic_add(&_generations_in_flight, i32(len(jobs)))
+    utils.submit_batch(&_jobs, jobs[:])
+}
+
+// Runs on the job threads. Saved chunks come from their region file,
+// everything else from the terrain generator.
 generate_chunk::proc(pos: ChunkPos) {
     chunk_layout := ChunkLayout{}
+
+    sync.mutex_lock(&_pool_lock)
     mask, ok := utils.acquire(&_render_mask_pool)
+    sync.mutex_unlock(&_pool_lock)
     if !ok {
         fmt.println("Failed to acquire render mask")
         return
     }
 
-    for x := i32(0); x < 16; x += 1 {
-        for z := i32(0); z < 16; z += 1 {
-            height := cast(i32)noise.noise_2d(_noise_seed, {
-                f64((pos.x*16 + x) / WORLD_HEIGHT),
-                f64((pos.z*16 + z) / WORLD_HEIGHT)
-            })
-            height = clamp(height - pos.y*16, 0, 16)
-            
-            for y := i32(0); y < 16; y += 1 {
-                chunk_layout[y + x*16 + z*16*16] = 1
-            }
-            mask[x + z*16] = transmute(u16)((1 << transmute(u32)height) - 1)
-        }
+    if read_chunk(pos, &chunk_layout) {
+        build_cull_mask(chunk_layout[:], mask)
+    } else {
+        generate_chunk_layout(pos, &chunk_layout, mask)
     }
-    _chunks[pos] = construct_chunk(chunk_layout[:], mask)
-    utils.enqueue(&_render_chunks_to_update, pos)
+    publish_chunk(pos, construct_chunk(chunk_layout[:], mask))
 }
 
-construct_chunk::proc(layout: []BlockID, mask: ^ChunkBitMask) -> (chunk: Chunk) {
-    @(static) block_counts := map[BlockID]u32{}
+generate_chunk_layout::proc(pos: ChunkPos, chunk_layout: ^ChunkLayout, mask: ^ChunkBitMask) {
+    column : ColumnData
+    get_column(&_column_cache, pos.xz, &column)
 
-    chunk.cull_mask = mask
+    for z := i32(0); z < 16; z += 1 {
+        for x := i32(0); x < 16; x += 1 {
+            surface_y := column.heights[x + z*16] - pos.y*16
 
-    for block in layout {
-        block_counts[block] += 1
-    }
+            // how many blocks of this column are solid inside this chunk
+            height := clamp(surface_y, 0, 16)
 
-    if len(block_counts) > 255 {
-        chunk.large, _ = utils.acquire(&_large_chunk_pool)
-        chunk.small = nil
-        copy(chunk.large.data[:], layout[:])
-    } else {
-        chunk.small, _ = utils.acquire(&_small_chunk_pool)
-        chunk.large = nil
-    
-        i := u32(0)
-        for id, &count in block_counts {
-            append(&chunk.small.blocks, id)
-            // small.blocks is only a 1-way conversion, so we do this instead
-            i += 1
-            count = i // keep in mind this starts from 1, 0 is reserved for air.
+            for y := i32(0); y < height; y += 1 {
+                chunk_layout[chunk_block_index(x, y, z)] = 1
+            }
+            if surface_y > 0 && surface_y <= 16 {
+                chunk_layout[chunk_block_index(x, surface_y-1, z)] = column.surface[x + z*16]
+            }
+            mask[x + z*16] = u16((u32(1) << u32(height)) - 1)
         }
-    
-        for i in 0..<16*16*16 {
-            idx := layout[i]
-            chunk.small.data[i] = u8(idx == 0 ? 0 : block_counts[idx])
+    }
+}
+
+// Every block that isn't air is solid.
+build_cull_mask::proc(layout: []BlockID, mask: ^ChunkBitMask) {
+    for column in 0..<16*16 {
+        bits : u16
+        for y in 0..<16 {
+            if layout[column*16 + y] != 0 do bits |= 1 << u16(y)
         }
+        mask[column] = bits
     }
+}
 
-    clear(&block_counts)
+// Makes a finished chunk visible to the other threads and queues it for meshing.
+publish_chunk::proc(pos: ChunkPos, chunk: Chunk) {
+    // nobody else can see the chunk yet
+    refresh_active_blocks(pos, chunk.blocks)
+
+    // the center can't move between the check and the insert, otherwise
+    // the world thread could miss this chunk when unloading
+    sync.mutex_lock(&_center_lock)
+    in_view := _has_center && is_in_cube(pos, _center, RENDER_DISTANCE)
+    result := ChunkInsertResult.INSERTED
+    stale : Chunk
+    stale_pos : ChunkPos
+    if in_view do result, stale, stale_pos = chunk_store_insert(&_chunk_store, pos, chunk)
+    sync.mutex_unlock(&_center_lock)
+
+    // the world thread won't find it to remove anymore, it's on us
+    if result == .EVICTED do retire_chunk(stale_pos, stale)
+    if !in_view {
+        drop_active_blocks(pos)
+        release_chunk(chunk)
+        return
+    }
+    if result == .ALREADY_LOADED {
+        // shouldn't happen with `claim_generation`, but the loaded one wins,
+        // and the ticking blocks have to be its own again
+        utils.log(.WARNING, "Chunk", pos, "was generated while it was loaded")
+        release_chunk(chunk)
+        restore_active_blocks(pos)
+        return
+    }
+
+    queue_chunk_remesh(pos)
+    utils.post_deferred(.CHUNK_READY, pos)
+
+    // the neighbours' shells may be hidden by this chunk now
+    for offset in CHUNK_NEIGHBOURS {
+        neighbour := pos + offset
+        if chunk_store_has(&_chunk_store, neighbour) do queue_chunk_remesh(neighbour, changed = false)
+    }
+}
+
+construct_chunk::proc(layout: []BlockID, mask: ^ChunkBitMask) -> (chunk: Chunk) {
+    chunk.cull_mask = mask
+
+    sync.mutex_lock(&_pool_lock)
+    chunk.blocks, _ = utils.acquire(&_block_storage_pool)
+    sync.mutex_unlock(&_pool_lock)
+
+    block_storage_fill(chunk.blocks, layout)
     return chunk
 }
 
+@(private="file")
+restore_active_blocks::proc(pos: ChunkPos) {
+    chunk_store_read_lock(&_chunk_store)
+    defer chunk_store_read_unlock(&_chunk_store)
+
+    loaded, ok := chunk_store_get(&_chunk_store, pos)
+    if !ok do return
+    chunk_store_lock_blocks(&_chunk_store, pos)
+    refresh_active_blocks(pos, loaded.blocks)
+    chunk_store_unlock_blocks(&_chunk_store, pos)
+}
+
 remove_chunk::proc(pos: ChunkPos) {
-    chunk, has := _chunks[pos]
+    chunk, has := chunk_store_remove(&_chunk_store, pos)
     if !has do return
+    retire_chunk(pos, chunk)
+}
 
-    delete_key(&_chunks, pos)
-    if chunk.small != nil {
-        clear(&chunk.small.blocks)
-        utils.release(&_small_chunk_pool, chunk.small)
-    } else {
-        utils.release(&_large_chunk_pool, chunk.large)
-    }
+@(private="file") _deactivate_lock : sync.Mutex
+
+// What's left to do once a chunk is out of the store, whether it was removed
+// or a newer chunk took its slot.
+@(private="file")
+retire_chunk::proc(pos: ChunkPos, chunk: Chunk) {
+    // a chunk that got evicted before the world thread removed it can still hold edits
+    if chunk.blocks.modified do queue_chunk_save(pos, chunk.blocks)
+    drop_active_blocks(pos)
+    release_chunk(chunk)
+
+    // job threads evict chunks too, and the queue only takes one producer at a time
+    sync.mutex_lock(&_deactivate_lock)
+    utils.enqueue(&_render_chunks_to_deactivate, pos)
+    sync.mutex_unlock(&_deactivate_lock)
+}
+
+// Hands the chunk's memory back to the pools.
+@(private="file")
+release_chunk::proc(chunk: Chunk) {
+    sync.mutex_lock(&_pool_lock)
+    defer sync.mutex_unlock(&_pool_lock)
+
+    block_storage_reset(chunk.blocks)
+    utils.release(&_block_storage_pool, chunk.blocks)
     utils.release(&_render_mask_pool, chunk.cull_mask)
 }
 
@@ -242,15 +540,16 @@ world_to_chunk_space::proc {
 }
 
 world_to_chunk_space_blockpos::proc(pos: BlockPos) -> (which_chunk: ChunkPos, at_where: ChunkedBlockPos) {
+    // shifts and masks round towards negative infinity, division doesn't
     which_chunk = ChunkPos{
-        pos.x / 16,
-        pos.y / 16,
-        pos.z / 16,
+        pos.x >> 4,
+        pos.y >> 4,
+        pos.z >> 4,
     }
     at_where = ChunkedBlockPos{
-        u8(pos.x % 16),
-        u8(pos.y % 16),
-        u8(pos.z % 16),
+        u8(pos.x & 15),
+        u8(pos.y & 15),
+        u8(pos.z & 15),
     }
     return which_chunk, at_where
 }
@@ -269,22 +568,91 @@ world_to_chunk_space_position::proc(pos: Position) -> (which_chunk: ChunkPos, at
     return which_chunk, at_where
 }
 
-change_block::proc(at: BlockPos, to: BlockID) {
-    // TODO: Implement
+// The block changes right away, the re-mesh waits for `flush_block_edits`
+// so a burst of edits re-meshes every chunk only once. Returns false if the
+// chunk isn't loaded. Can't be called while holding the chunk store read lock.
+change_block::proc(at: BlockPos, to: BlockID) -> (ok: bool) {
+    chunk_pos, in_chunk := world_to_chunk_space(at)
+
+    chunk := chunk_store_begin_edit(&_chunk_store, chunk_pos) or_return
+    old := set_chunk_block(chunk, in_chunk, to)
+    chunk_store_end_edit(&_chunk_store, chunk_pos)
+    if old == to do return true
+
+    mark_block_dirty(chunk_pos, in_chunk, shape_changed = (old == 0) != (to == 0))
+    update_active_block(chunk_pos, chunk_block_index(in_chunk.x, in_chunk.y, in_chunk.z), old, to)
+    return true
+}
+
+// Chunks edited since the last flush. The value is false for neighbours
+// that only need their faces rebuilt.
+@(private="file") _dirty_chunks : map[ChunkPos]bool
+@(private="file") _dirty_lock : sync.Mutex
+
+mark_chunk_dirty::proc(pos: ChunkPos, changed := true) {
+    sync.mutex_lock(&_dirty_lock)
+    defer sync.mutex_unlock(&_dirty_lock)
+    _dirty_chunks[pos] = _dirty_chunks[pos] || changed
+}
+
+// Neighbours only see the blocks on the border, and only whether they're air.
+mark_block_dirty::proc(pos: ChunkPos, at: ChunkedBlockPos, shape_changed: bool) {
+    mark_chunk_dirty(pos)
+    if !shape_changed do return
+
+    if at.x == 0  do mark_chunk_dirty(pos - ChunkPos{1, 0, 0}, false)
+    if at.x == 15 do mark_chunk_dirty(pos + ChunkPos{1, 0, 0}, false)
+    if at.y == 0  do mark_chunk_dirty(pos - ChunkPos{0, 1, 0}, false)
+    if at.y == 15 do mark_chunk_dirty(pos + ChunkPos{0, 1, 0}, false)
+    if at.z == 0  do mark_chunk_dirty(pos - ChunkPos{0, 0, 1}, false)
+    if at.z == 15 do mark_chunk_dirty(pos + ChunkPos{0, 0, 1}, false)
 }
 
+// Queues a re-mesh for everything edited since the last call. Runs at the
+// end of every tick and before every frame.
+flush_block_edits::proc() {
+    sync.mutex_lock(&_dirty_lock)
+    if len(_dirty_chunks) == 0 {
+        sync.mutex_unlock(&_dirty_lock)
+        return
+    }
+    dirty := _dirty_chunks
+    _dirty_chunks = make(map[ChunkPos]bool, len(dirty))
+    sync.mutex_unlock(&_dirty_lock)
+
+    for pos, changed in dirty {
+        if chunk_store_has(&_chunk_store, pos) do queue_chunk_remesh(pos, changed)
+    }
+    delete(dirty)
+}
+
+// Can't be called while holding the chunk store read lock.
 get_block::proc(at: BlockPos) -> (block: BlockID) {
-    chunk_pos, block_pos_in_chunk := world_to_chunk_space(at)
+    chunk_pos, in_chunk := world_to_chunk_space(at)
 
-    chunk, has := _chunks[chunk_pos]
+    // the storage's palette and data get freed when the chunk is released or
+    // edited, so an optimistic read could land in freed memory. The read lock
+    // covers releasing, the blocks lock editing.
+    chunk_store_read_lock(&_chunk_store)
+    defer chunk_store_read_unlock(&_chunk_store)
+
+    chunk, has := chunk_store_get(&_chunk_store, chunk_pos)
     if !has do return 0 // TODO: handle this better
 
-    if chunk.large != nil {
-        return chunk.large.data[block_pos_in_chunk.x + block_pos_in_chunk.y*16 + block_pos_in_chunk.z*16*16]
-    } else {
-        idx := chunk.small.data[block_pos_in_chunk.x + block_pos_in_chunk.y*16 + block_pos_in_chunk.z*16*16]
-        return chunk.small.blocks[idx]
-    }
+    chunk_store_lock_blocks(&_chunk_store, chunk_pos)
+    defer chunk_store_unlock_blocks(&_chunk_store, chunk_pos)
+    return block_storage_get(chunk.blocks, chunk_block_index(in_chunk.x, in_chunk.y, in_chunk.z))
+}
+
+CHUNK_NEIGHBOURS :: [6]ChunkPos{
+    {1, 0, 0}, {-1, 0, 0},
+    {0, 1, 0}, {0, -1, 0},
+    {0, 0, 1}, {0, 0, -1},
+}
+
+// Chunks are laid out yxz, y changes the fastest.
+chunk_block_index::#force_inline proc(#any_int x, y, z: int) -> int {
+    return y + x*16 + z*16*16
 }
 
 // find_extremes::proc // TODO: Implement
@@ -294,23 +662,89 @@ set_chunk_block:: proc {
     set_chunk_block_nums,
 }
 
-set_chunk_block_vec:: #force_inline proc(chunk: Chunk, at: ChunkedBlockPos, to: BlockID) {
-    if chunk.large != nil {
-        chunk.large.data[at.x + at.y*16 + at.z*16*16] = to
+// Keeps the cull mask in sync, but doesn't queue anything for meshing.
+// Use `change_block` unless you already have the chunk to yourself.
+set_chunk_block_vec:: #force_inline proc(chunk: Chunk, at: ChunkedBlockPos, to: BlockID) -> (old: BlockID) {
+    return set_chunk_block_nums(chunk, at.x, at.y, at.z, to)
+}
+
+set_chunk_block_nums:: #force_inline proc(chunk: Chunk, #any_int x, y, z: int, to: BlockID) -> (old: BlockID) {
+    old = block_storage_set(chunk.blocks, chunk_block_index(x, y, z), to)
+    if to != 0 {
+        chunk.cull_mask[x + z*16] |= 1 << u16(y)
     } else {
-        idx := chunk.small.data[at.x + at.y*16 + at.z*16*16]
-        chunk.small.data[at.x + at.y*16 + at.z*16*16] = u8(idx == 0 ? 0 : to)
+        chunk.cull_mask[x + z*16] &~= 1 << u16(y)
     }
+    return old
 }
 
-set_chunk_block_nums:: #force_inline proc(chunk: Chunk, #any_int x, y, z: int, to: BlockID) {
-    if chunk.large != nil {
-        chunk.large.data[x + y*16 + z*16*16] = to
-    } else {
-        idx := chunk.small.data[x + y*16 + z*16*16]
-        chunk.small.data[x + y*16 + z*16*16] = u8(idx == 0 ? 0 : to)
+// Hash of every loaded block, to check that two runs (say, with and without
+// PARALLEL_TICKS) ended up with the same world.
+world_hash::proc() -> (h: u64) {
+    chunk_store_read_lock(&_chunk_store)
+    defer chunk_store_read_unlock(&_chunk_store)
+
+    // slot order only depends on which chunks are loaded, not on when
+    it := make_chunk_store_iterator(&_chunk_store)
+    for chunk, pos in iterate_chunks(&it) {
+        blocks : ChunkBlocks
+        chunk_store_lock_blocks(&_chunk_store, pos)
+        block_storage_decode(chunk.blocks, blocks[:])
+        chunk_store_unlock_blocks(&_chunk_store, pos)
+
+        pos := pos
+        h = hash.fnv64a(mem.ptr_to_bytes(&pos), h)
+        h = hash.fnv64a(slice.to_bytes(blocks[:]), h)
     }
+    return h
+}
+
+// A world of its own for tests. Chunks only get in through
+// `load_test_chunk`, nothing is generated, saved or meshed, and edits are
+// never flushed. Undo with `destroy_test_world`.
+@(private)
+init_test_world::proc(radius: i32) {
+    init_chunk_store(&_chunk_store, radius)
+    _block_storage_pool = utils.create_pool(BlockStorage, 16)
+    _render_mask_pool = utils.create_pool(ChunkBitMask, 16)
+}
+
+@(private)
+load_test_chunk::proc(pos: ChunkPos, layout: []BlockID) {
+    sync.mutex_lock(&_pool_lock)
+    mask, _ := utils.acquire(&_render_mask_pool)
+    sync.mutex_unlock(&_pool_lock)
+
+    build_cull_mask(layout, mask)
+    chunk := construct_chunk(layout, mask)
+    refresh_active_blocks(pos, chunk.blocks)
+    chunk_store_insert(&_chunk_store, pos, chunk)
 }
 
+@(private)
+destroy_test_world::proc() {
+    it := make_chunk_store_iterator(&_chunk_store)
+    for chunk in iterate_chunks(&it) do block_storage_destroy(chunk.blocks)
+    utils.call_for_all(&_block_storage_pool, struct{}{}, proc(blocks: ^BlockStorage, _: struct{}) {
+        block_storage_destroy(blocks)
+    })
+    utils.destroy(&_block_storage_pool)
+    utils.destroy(&_render_mask_pool)
+
+    destroy_chunk_store(&_chunk_store)
+    delete(_dirty_chunks)
+    _dirty_chunks = nil
+    destroy_block_ticks()
+}
 
+// Memory held by every loaded chunk's blocks and cull mask.
+loaded_chunk_memory::proc() -> (bytes: int) {
+    chunk_store_read_lock(&_chunk_store)
+    defer chunk_store_read_unlock(&_chunk_store)
 
+    it := make_chunk_store_iterator(&_chunk_store)
+    for chunk in iterate_chunks(&it) {
+        bytes += block_storage_bytes(chunk.blocks) + size_of(ChunkBitMask)
+    }
+    return bytes
+}
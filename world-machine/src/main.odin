@@ -1,8 +1,11 @@
 package main
 
 import "engine"
+import "src:utils"
 
 main::proc() {
+    context.assertion_failure_proc = utils.log_assertion_failure
+
     engine.init()
     engine.main_loop()
     engine.deinit()
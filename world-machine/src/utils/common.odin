@@ -3,7 +3,10 @@ package utils
 destroy::proc {
     destroy_regular_queue,
     destroy_one_to_one_queue,
+    destroy_mpmc_queue,
+    destroy_work_deque,
     destroy_pool,
+    destroy_range_allocator,
 }
 
 expand_queue::proc {
@@ -14,16 +17,20 @@ expand_queue::proc {
 enqueue::proc {
     enqueue_regular,
     enqueue_one_to_one,
+    enqueue_mpmc,
 }
 
 dequeue::proc {
     dequeue_regular,
     dequeue_one_to_one,
+    dequeue_mpmc,
 }
 
 is_empty::proc {
     is_empty_regular,
     is_empty_one_to_one,
+    is_empty_mpmc,
+    is_empty_work_deque,
 }
 
 call_for_all::proc {
@@ -35,5 +42,7 @@ call_for_all::proc {
 length::proc {
     len_regular,
     len_one_to_one,
+    len_mpmc,
+    len_work_deque,
     len_pool,
 }
\ No newline at end of file
@@ -0,0 +1,214 @@
+package utils
+
+import "core:log"
+import "core:os"
+import "core:sync"
+import "core:testing"
+import "core:thread"
+import "core:time"
+
+// Hammers the deque, the queue and the job system from a few threads at
+// once. Every element has to come out exactly once.
+
+@(private="file") STRESS_THREADS :: 4
+@(private="file") STRESS_ITEMS :: 1 << 18
+@(private="file") STRESS_FANOUT :: 16
+
+@(test)
+test_work_deque_stress::proc(t: ^testing.T) {
+    _, lost, duplicated := stress_work_deque(STRESS_THREADS, STRESS_ITEMS)
+    testing.expectf(t, lost == 0 && duplicated == 0, "work deque lost %d and duplicated %d of %d elements", lost, duplicated, STRESS_ITEMS)
+}
+
+@(test)
+test_mpmc_queue_stress::proc(t: ^testing.T) {
+    _, lost, duplicated := stress_mpmc_queue(STRESS_THREADS, STRESS_ITEMS)
+    testing.expectf(t, lost == 0 && duplicated == 0, "mpmc queue lost %d and duplicated %d of %d elements", lost, duplicated, STRESS_ITEMS)
+}
+
+@(test)
+test_job_system_stress::proc(t: ^testing.T) {
+    _, lost, duplicated, executed := stress_job_system(STRESS_THREADS, STRESS_ITEMS)
+    testing.expectf(t, lost == 0 && duplicated == 0, "job system lost %d and duplicated %d of %d jobs", lost, duplicated, STRESS_ITEMS)
+    testing.expect_value(t, executed, STRESS_ITEMS + STRESS_ITEMS / STRESS_FANOUT)
+}
+
+when ENABLE_BENCHMARKS {
+
+    // Throughput of each of them with every thread count from 1 up to one
+    // per core. Run with `./nob test -bench`, which runs the tests one at a
+    // time so they don't skew each other.
+    @(test)
+    bench_job_throughput::proc(t: ^testing.T) {
+        ITEMS :: 1 << 20
+
+        for threads in 1..=max(os.processor_core_count(), 1) {
+            deque, _, _ := stress_work_deque(threads, ITEMS)
+            queue, _, _ := stress_mpmc_queue(threads, ITEMS)
+            jobs, _, _, _ := stress_job_system(threads, ITEMS)
+            log.infof("%d threads: work deque %.0f ops/sec, mpmc queue %.0f ops/sec, job system %.0f jobs/sec", threads, deque, queue, jobs)
+        }
+    }
+
+}
+
+@(private="file")
+StressState::struct {
+    seen: []i32, // how many times each element came out
+    deque: ^WorkDeque(int),
+    queue: ^MPMCQueue(int),
+    producers: int,
+    next_producer: int,
+    remaining: int,
+    done: bool,
+}
+
+@(private="file")
+StressJobs::struct {
+    js: ^JobSystem,
+    group: ^JobGroup,
+    seen: []i32,
+}
+
+@(private="file")
+StressJob::struct {
+    ctx: ^StressJobs,
+    index: int,
+}
+
+// The owner pushes and pops at the bottom while the thieves steal from the
+// top. Starts tiny so it has to grow under them a few times.
+@(private="file")
+stress_work_deque::proc(thieves, items: int) -> (ops_per_sec: f64, lost, duplicated: int) {
+    d := create_work_deque(int, 16)
+    defer destroy_work_deque(&d)
+    state := StressState{seen = make([]i32, items), deque = &d}
+    defer delete(state.seen)
+
+    start := time.tick_now()
+    threads := make([]^thread.Thread, thieves)
+    defer delete(threads)
+    for &t in threads {
+        t = thread.create_and_start_with_data(&state, proc(data: rawptr) {
+            s := (^StressState)(data)
+            for !sync.atomic_load(&s.done) {
+                if v, ok := steal(s.deque); ok do sync.atomic_add(&s.seen[v], 1)
+            }
+        })
+    }
+
+    for i in 0..<items {
+        push_bottom(&d, i)
+        // every other push, so the owner keeps racing the thieves for the last one
+        if i % 2 == 1 {
+            if v, popped := pop_bottom(&d); popped do sync.atomic_add(&state.seen[v], 1)
+        }
+    }
+    for {
+        v := pop_bottom(&d) or_break
+        sync.atomic_add(&state.seen[v], 1)
+    }
+    sync.atomic_store(&state.done, true)
+    for t in threads {
+        thread.join(t)
+        thread.destroy(t)
+    }
+    seconds := time.duration_seconds(time.tick_since(start))
+
+    lost, duplicated = count_seen(state.seen)
+    return f64(items) / seconds, lost, duplicated
+}
+
+// As many producers as consumers on a small queue, so it wraps around a lot
+// and both ends keep running into each other.
+@(private="file")
+stress_mpmc_queue::proc(threads, items: int) -> (ops_per_sec: f64, lost, duplicated: int) {
+    q := create_mpmc_queue(int, 256)
+    defer destroy_mpmc_queue(&q)
+    total := items / threads * threads
+    state := StressState{seen = make([]i32, total), queue = &q, remaining = total, producers = threads}
+    defer delete(state.seen)
+
+    start := time.tick_now()
+    running := make([dynamic]^thread.Thread, 0, 2*threads)
+    defer delete(running)
+    for _ in 0..<threads {
+        append(&running, thread.create_and_start_with_data(&state, proc(data: rawptr) {
+            s := (^StressState)(data)
+            per_producer := len(s.seen) / s.producers
+            first := sync.atomic_add(&s.next_producer, 1) * per_producer
+            for v in first..<first + per_producer {
+                for !enqueue_mpmc(s.queue, v) do thread.yield()
+            }
+        }))
+    }
+    for _ in 0..<threads {
+        append(&running, thread.create_and_start_with_data(&state, proc(data: rawptr) {
+            s := (^StressState)(data)
+            for sync.atomic_load(&s.remaining) > 0 {
+                v, ok := dequeue_mpmc(s.queue)
+                if !ok {
+                    thread.yield()
+                    continue
+                }
+                sync.atomic_add(&s.seen[v], 1)
+                sync.atomic_sub(&s.remaining, 1)
+            }
+        }))
+    }
+    for t in running {
+        thread.join(t)
+        thread.destroy(t)
+    }
+    seconds := time.duration_seconds(time.tick_since(start))
+
+    lost, duplicated = count_seen(state.seen)
+    return f64(total) / seconds, lost, duplicated
+}
+
+// Jobs submitted from outside go through the injector, and every one of
+// them submits more from its worker, which the others have to steal.
+@(private="file")
+stress_job_system::proc(workers, items: int) -> (jobs_per_sec: f64, lost, duplicated, executed: int) {
+    js : JobSystem
+    init_job_system(&js, workers)
+    defer destroy_job_system(&js)
+
+    group : JobGroup
+    ctx := StressJobs{js = &js, group = &group, seen = make([]i32, items / STRESS_FANOUT * STRESS_FANOUT)}
+    defer delete(ctx.seen)
+
+    child_job :: proc(job: ^StressJob) {
+        sync.atomic_add(&job.ctx.seen[job.index], 1)
+    }
+    parent_job :: proc(job: ^StressJob) {
+        for k in 0..<STRESS_FANOUT {
+            submit(job.ctx.js, make_job(child_job, StressJob{job.ctx, job.index*STRESS_FANOUT + k}, job.ctx.group))
+        }
+    }
+
+    parents := len(ctx.seen) / STRESS_FANOUT
+    start := time.tick_now()
+    batch := make([dynamic]Job, 0, 64)
+    defer delete(batch)
+    for first := 0; first < parents; first += 64 {
+        clear(&batch)
+        for i in first..<min(first + 64, parents) do append(&batch, make_job(parent_job, StressJob{&ctx, i}, &group))
+        submit_batch(&js, batch[:])
+    }
+    wait_for_group(&js, &group)
+    seconds := time.duration_seconds(time.tick_since(start))
+
+    lost, duplicated = count_seen(ctx.seen)
+    executed = sync.atomic_load(&js.executed)
+    return f64(executed) / seconds, lost, duplicated, executed
+}
+
+@(private="file")
+count_seen::proc(seen: []i32) -> (lost, duplicated: int) {
+    for n in seen {
+        if n == 0 do lost += 1
+        if n > 1 do duplicated += 1
+    }
+    return lost, duplicated
+}
@@ -0,0 +1,504 @@
+package utils
+
+import "base:runtime"
+
+import "core:sync"
+import "core:thread"
+import "core:mem"
+
+// Bounded multi-producer multi-consumer ring (Dmitry Vyukov's design).
+// Every cell carries a sequence number, so producers only race with other
+// producers and consumers only with other consumers.
+MPMCQueue::struct($T:typeid) {
+    cells: [^]MPMCCell(T),
+    mask: int,
+    enqueue_pos: int,
+    _: [64]u8, // keep the two counters on different cache lines
+    dequeue_pos: int,
+}
+
+MPMCCell::struct($T:typeid) {
+    sequence: int,
+    data: T,
+}
+
+// Capacity is rounded up to a power of two.
+@(require_results)
+create_mpmc_queue::proc($T:typeid, capacity:int = 1024) -> MPMCQueue(T) {
+    size := 2
+    for size < capacity do size <<= 1
+
+    data_ptr, _ := mem.alloc(size * size_of(MPMCCell(T)))
+    q := MPMCQueue(T){
+        cells = transmute([^]MPMCCell(T))data_ptr,
+        mask = size - 1,
+    }
+    for i in 0..<size {
+        q.cells[i].sequence = i
+    }
+    return q
+}
+
+destroy_mpmc_queue::proc(q: ^MPMCQueue($T)) {
+    ptr := q.cells
+    q.cells = nil
+    free(ptr)
+}
+
+// Returns false if the queue is full.
+enqueue_mpmc::proc(q: ^MPMCQueue($T), elem: T) -> (ok: bool) {
+    assert(q.cells != nil, "Queue is not initialized or destroyed")
+    pos := sync.atomic_load_explicit(&q.enqueue_pos, .Relaxed)
+    for {
+        cell := &q.cells[pos & q.mask]
+        seq := sync.atomic_load_explicit(&cell.sequence, .Acquire)
+        diff := seq - pos
+
+        if diff == 0 {
+            cur, won := sync.atomic_compare_exchange_weak_explicit(&q.enqueue_pos, pos, pos + 1, .Relaxed, .Relaxed)
+            if won {
+                cell.data = elem
+                sync.atomic_store_explicit(&cell.sequence, pos + 1, .Release)
+                return true
+            }
+            pos = cur
+        } else if diff < 0 {
+            return false
+        } else {
+            pos = sync.atomic_load_explicit(&q.enqueue_pos, .Relaxed)
+        }
+    }
+}
+
+dequeue_mpmc::proc(q: ^MPMCQueue($T)) -> (elem: T, ok: bool) #optional_ok {
+    assert(q.cells != nil, "Queue is not initialized or destroyed")
+    pos := sync.atomic_load_explicit(&q.dequeue_pos, .Relaxed)
+    for {
+        cell := &q.cells[pos & q.mask]
+        seq := sync.atomic_load_explicit(&cell.sequence, .Acquire)
+        diff := seq - (pos + 1)
+
+        if diff == 0 {
+            cur, won := sync.atomic_compare_exchange_weak_explicit(&q.dequeue_pos, pos, pos + 1, .Relaxed, .Relaxed)
+            if won {
+                elem = cell.data
+                sync.atomic_store_explicit(&cell.sequence, pos + q.mask + 1, .Release)
+                return elem, true
+            }
+            pos = cur
+        } else if diff < 0 {
+            return T{}, false
+        } else {
+            pos = sync.atomic_load_explicit(&q.dequeue_pos, .Relaxed)
+        }
+    }
+}
+
+// Enqueues as many elements as fit, returns how many did.
+enqueue_batch_mpmc::proc(q: ^MPMCQueue($T), elems: []T) -> (count: int) {
+    for elem in elems {
+        if !enqueue_mpmc(q, elem) do break
+        count += 1
+    }
+    return count
+}
+
+// Fills `out` with up to `len(out)` elements, returns how many it got.
+dequeue_batch_mpmc::proc(q: ^MPMCQueue($T), out: []T) -> (count: int) {
+    for &elem in out {
+        ok : bool
+        elem, ok = dequeue_mpmc(q)
+        if !ok do break
+        count += 1
+    }
+    return count
+}
+
+is_empty_mpmc::proc(q: ^MPMCQueue($T)) -> bool {
+    return sync.atomic_load(&q.enqueue_pos) == sync.atomic_load(&q.dequeue_pos)
+}
+
+// Approximate, the counters keep moving while we read them.
+len_mpmc::#force_inline proc(q: MPMCQueue($T)) -> int {
+    return max(q.enqueue_pos - q.dequeue_pos, 0)
+}
+
+
+// Chase-Lev work stealing deque. Only the owning thread may push and pop
+// at the bottom, any thread may steal from the top.
+WorkDeque::struct($T:typeid) {
+    top: int,
+    _: [64]u8,
+    bottom: int,
+    buffer: ^WorkDequeBuffer(T),
+    growable: bool,
+    // thieves may still be reading from these, so they live until destroy
+    retired: [dynamic]^WorkDequeBuffer(T),
+}
+
+WorkDequeBuffer::struct($T:typeid) {
+    data: [^]T,
+    mask: int,
+}
+
+// In bounded mode `push_bottom` fails when the deque is full,
+// otherwise the buffer doubles.
+@(require_results)
+create_work_deque::proc($T:typeid, capacity:int = 256, growable := true) -> WorkDeque(T) {
+    size := 2
+    for size < capacity do size <<= 1
+
+    return WorkDeque(T){
+        buffer = create_work_deque_buffer(T, size),
+        growable = growable,
+    }
+}
+
+@(private="file")
+create_work_deque_buffer::proc($T:typeid, size: int) -> ^WorkDequeBuffer(T) {
+    buf := new(WorkDequeBuffer(T))
+    data_ptr, _ := mem.alloc(size * size_of(T))
+    buf.data = transmute([^]T)data_ptr
+    buf.mask = size - 1
+    return buf
+}
+
+@(private="file")
+free_work_deque_buffer::proc(buf: ^WorkDequeBuffer($T)) {
+    free(buf.data)
+    free(buf)
+}
+
+destroy_work_deque::proc(d: ^WorkDeque($T)) {
+    for buf in d.retired {
+        free_work_deque_buffer(buf)
+    }
+    delete(d.retired)
+    free_work_deque_buffer(d.buffer)
+    d.buffer = nil
+}
+
+@(private="file")
+grow_work_deque::proc(d: ^WorkDeque($T), old: ^WorkDequeBuffer(T), top, bottom: int) -> ^WorkDequeBuffer(T) {
+    buf := create_work_deque_buffer(T, (old.mask + 1) * 2)
+    for i in top..<bottom {
+        buf.data[i & buf.mask] = old.data[i & old.mask]
+    }
+    append(&d.retired, old)
+    sync.atomic_store_explicit(&d.buffer, buf, .Release)
+    return buf
+}
+
+// Owner only.
+push_bottom::proc(d: ^WorkDeque($T), elem: T) -> (ok: bool) {
+    b := sync.atomic_load_explicit(&d.bottom, .Relaxed)
+    t := sync.atomic_load_explicit(&d.top, .Acquire)
+    buf := sync.atomic_load_explicit(&d.buffer, .Relaxed)
+
+    if b - t > buf.mask {
+        if !d.growable do return false
+        buf = grow_work_deque(d, buf, t, b)
+    }
+
+    buf.data[b & buf.mask] = elem
+    sync.atomic_thread_fence(.Release)
+    sync.atomic_store_explicit(&d.bottom, b + 1, .Relaxed)
+    return true
+}
+
+// Owner only. Takes the most recently pushed element.
+pop_bottom::proc(d: ^WorkDeque($T)) -> (elem: T, ok: bool) #optional_ok {
+    b := sync.atomic_load_explicit(&d.bottom, .Relaxed) - 1
+    buf := sync.atomic_load_explicit(&d.buffer, .Relaxed)
+    sync.atomic_store_explicit(&d.bottom, b, .Relaxed)
+    sync.atomic_thread_fence(.Seq_Cst)
+    t := sync.atomic_load_explicit(&d.top, .Relaxed)
+
+    if t > b {
+        sync.atomic_store_explicit(&d.bottom, b + 1, .Relaxed)
+        return T{}, false
+    }
+
+    elem = buf.data[b & buf.mask]
+    if t == b {
+        // last element, race the thieves for it
+        _, won := sync.atomic_compare_exchange_strong_explicit(&d.top, t, t + 1, .Seq_Cst, .Relaxed)
+        sync.atomic_store_explicit(&d.bottom, b + 1, .Relaxed)
+        if !won do return T{}, false
+    }
+    return elem, true
+}
+
+// Any thread. Takes the oldest element, can fail if another thread got there first.
+steal::proc(d: ^WorkDeque($T)) -> (elem: T, ok: bool) #optional_ok {
+    t := sync.atomic_load_explicit(&d.top, .Acquire)
+    sync.atomic_thread_fence(.Seq_Cst)
+    b := sync.atomic_load_explicit(&d.bottom, .Acquire)
+    if t >= b do return T{}, false
+
+    buf := sync.atomic_load_explicit(&d.buffer, .Acquire)
+    elem = buf.data[t & buf.mask]
+    _, won := sync.atomic_compare_exchange_strong_explicit(&d.top, t, t + 1, .Seq_Cst, .Relaxed)
+    if !won do return T{}, false
+    return elem, true
+}
+
+is_empty_work_deque::proc(d: ^WorkDeque($T)) -> bool {
+    return sync.atomic_load(&d.bottom) <= sync.atomic_load(&d.top)
+}
+
+len_work_deque::#force_inline proc(d: WorkDeque($T)) -> int {
+    return max(d.bottom - d.top, 0)
+}
+
+
+// Job system built on the two above. Every worker owns a deque, jobs
+// submitted from a worker go to its own deque and idle workers steal
+// from the others. Jobs from any other thread go through the injector.
+//
+// A job can end up running on any thread that waits or submits, not just on
+// the workers, so it must never `free_all` the temp allocator: it would pull
+// the rug from under the thread it happens to run on. Whatever a job puts in
+// the temp allocator is given back when it returns.
+
+JOB_PAYLOAD_WORDS :: 3
+
+Job::struct {
+    procedure: proc(payload: rawptr),
+    payload: [JOB_PAYLOAD_WORDS]u64,
+    group: ^JobGroup,
+}
+
+// Counts unfinished jobs, use `wait_for_group` to block on it.
+JobGroup::struct {
+    pending: sync.Futex,
+}
+
+JobWorker::struct {
+    system: ^JobSystem,
+    deque: WorkDeque(Job),
+    thread: ^thread.Thread,
+    index: int,
+    rng: u32,
+}
+
+JobSystem::struct {
+    workers: []JobWorker,
+    injector: MPMCQueue(Job),
+    running: b32,
+
+    // bumped on every submit, idle workers sleep on it
+    wake: sync.Futex,
+    sleeping: i32,
+
+    executed: int,
+    stolen: int,
+}
+
+@(private="file", thread_local)
+_current_worker : ^JobWorker
+
+// The payload is copied into the job, so it has to be small and must not
+// point into the submitter's stack.
+@(require_results)
+make_job::proc(procedure: proc(payload: ^$T), payload: T, group: ^JobGroup = nil) -> (job: Job)
+    where size_of(T) <= JOB_PAYLOAD_WORDS * size_of(u64) {
+    job.procedure = transmute(proc(rawptr))procedure
+    (^T)(&job.payload)^ = payload
+    job.group = group
+    return job
+}
+
+// Needs a stable address since the workers point back to it.
+init_job_system::proc(js: ^JobSystem, thread_count: int, injector_capacity := 1 << 14) {
+    js^ = JobSystem{
+        workers = make([]JobWorker, thread_count),
+        injector = create_mpmc_queue(Job, injector_capacity),
+        running = true,
+    }
+
+    for &worker, i in js.workers {
+        worker = JobWorker{
+            system = js,
+            deque = create_work_deque(Job),
+            index = i,
+            rng = u32(i) * 2654435761 + 1,
+        }
+    }
+    // only start them once every deque exists, they steal from each other right away
+    for &worker in js.workers {
+        worker.thread = thread.create_and_start_with_data(&worker, job_worker_loop)
+    }
+}
+
+// Stops the workers. Jobs that were never picked up are dropped.
+destroy_job_system::proc(js: ^JobSystem) {
+    sync.atomic_store(&js.running, false)
+    sync.atomic_add(&js.wake, 1)
+    sync.futex_broadcast(&js.wake)
+
+    for &worker in js.workers {
+        thread.join(worker.thread)
+        thread.destroy(worker.thread)
+        destroy_work_deque(&worker.deque)
+    }
+    delete(js.workers)
+    destroy_mpmc_queue(&js.injector)
+}
+
+submit::proc(js: ^JobSystem, job: Job) {
+    if job.group != nil do sync.atomic_add(&job.group.pending, 1)
+    push_job(js, job)
+    wake_workers(js, 1)
+}
+
+// Same as calling `submit` for each job, but only wakes the workers once.
+submit_batch::proc(js: ^JobSystem, jobs: []Job) {
+    for job in jobs {
+        if job.group != nil do sync.atomic_add(&job.group.pending, 1)
+    }
+    for job in jobs {
+        push_job(js, job)
+    }
+    wake_workers(js, len(jobs))
+}
+
+// Blocks until every job in the group is done. The calling thread runs
+// jobs itself while it waits instead of just sleeping.
+wait_for_group::proc(js: ^JobSystem, group: ^JobGroup) {
+    for {
+        pending := sync.atomic_load(&group.pending)
+        if pending == 0 do return
+        if help(js) do continue
+        sync.futex_wait(&group.pending, u32(pending))
+    }
+}
+
+// Runs a single job if there's one to be found. Useful for threads that
+// would otherwise just spin.
+help::proc(js: ^JobSystem) -> (did_work: bool) {
+    worker := _current_worker
+    if worker != nil && worker.system != js do worker = nil
+
+    job, ok := find_job(js, worker)
+    if !ok do return false
+    run_job(js, job)
+    return true
+}
+
+// Index of the worker running the calling thread, -1 if it's not one.
+current_worker_index::proc(js: ^JobSystem) -> int {
+    worker := _current_worker
+    if worker == nil || worker.system != js do return -1
+    return worker.index
+}
+
+@(private="file")
+push_job::proc(js: ^JobSystem, job: Job) {
+    worker := _current_worker
+    if worker != nil && worker.system == js {
+        // bounded deques run the job right here when full
+        if !push_bottom(&worker.deque, job) do run_job(js, job)
+        return
+    }
+    for !enqueue_mpmc(&js.injector, job) {
+        // the injector is full, make some room by doing work ourselves
+        if !help(js) do thread.yield()
+    }
+}
+
+@(private="file")
+wake_workers::proc(js: ^JobSystem, count: int) {
+    sync.atomic_add(&js.wake, 1)
+    sleeping := int(sync.atomic_load(&js.sleeping))
+    if sleeping == 0 do return
+
+    if count >= sleeping {
+        sync.futex_broadcast(&js.wake)
+    } else {
+        for _ in 0..<count do sync.futex_signal(&js.wake)
+    }
+}
+
+@(private="file")
+find_job::proc(js: ^JobSystem, worker: ^JobWorker) -> (job: Job, ok: bool) {
+    if worker != nil {
+        job, ok = pop_bottom(&worker.deque)
+        if ok do return
+    }
+
+    job, ok = dequeue_mpmc(&js.injector)
+    if ok do return
+
+    count := len(js.workers)
+    if count == 0 do return
+
+    start := 0
+    if worker != nil {
+        // xorshift, just so everyone doesn't hammer worker 0
+        worker.rng ~= worker.rng << 13
+        worker.rng ~= worker.rng >> 17
+        worker.rng ~= worker.rng << 5
+        start = int(worker.rng % u32(count))
+    }
+
+    for i in 0..<count {
+        victim := &js.workers[(start + i) % count]
+        if victim == worker do continue
+        job, ok = steal(&victim.deque)
+        if ok {
+            sync.atomic_add(&js.stolen, 1)
+            return
+        }
+    }
+    return
+}
+
+@(private="file")
+run_job::proc(js: ^JobSystem, job: Job) {
+    job := job
+    {
+        runtime.DEFAULT_TEMP_ALLOCATOR_TEMP_GUARD()
+        job.procedure(&job.payload)
+    }
+    sync.atomic_add(&js.executed, 1)
+
+    if job.group != nil && sync.atomic_sub(&job.group.pending, 1) == 1 {
+        sync.futex_broadcast(&job.group.pending)
+    }
+}
+
+@(private="file")
+job_worker_loop::proc(data: rawptr) {
+    worker := (^JobWorker)(data)
+    js := worker.system
+    _current_worker = worker
+    context.assertion_failure_proc = log_assertion_failure
+
+    for sync.atomic_load(&js.running) {
+        job, ok := find_job(js, worker)
+        if ok {
+            run_job(js, job)
+            continue
+        }
+
+        // read the counter before the last look, so a submit that
+        // lands in between makes the wait return right away
+        seen := sync.atomic_load(&js.wake)
+        sync.atomic_add(&js.sleeping, 1)
+
+        job, ok = find_job(js, worker)
+        if ok {
+            sync.atomic_sub(&js.sleeping, 1)
+            run_job(js, job)
+            continue
+        }
+
+        if sync.atomic_load(&js.running) {
+            sync.futex_wait(&js.wake, u32(seen))
+        }
+        sync.atomic_sub(&js.sleeping, 1)
+    }
+
+    _current_worker = nil
+}
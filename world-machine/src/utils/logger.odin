@@ -1,9 +1,15 @@
 package utils
 
+import "base:runtime"
+
+import "core:c/libc"
 import "core:time"
 import "core:os"
 import "core:fmt"
+import "core:slice"
 import "core:strings"
+import "core:sync"
+import "core:thread"
 
 
 ENABLE_BENCHMARKS :: #config(ENABLE_BENCHMARKS, false)
@@ -19,6 +25,55 @@ LogLevel::enum {
     ERROR,
 }
 
+// Logging doesn't touch the file on the calling thread. `log` formats the
+// message into a slot of the thread's own ring and returns, a background
+// thread takes the messages of every ring, puts them in order, adds the
+// timestamps and writes them out in one go. A thread gets its ring the
+// first time it logs.
+LOG_RING_SLOTS :: 1024
+LOG_MESSAGE_SIZE :: 240 // longer messages get cut off
+LOG_FLUSH_INTERVAL :: 10 * time.Millisecond
+
+// What a thread does when its ring is full. Errors always wait.
+LogFullPolicy::enum {
+    DROP,  // count it and move on, the writer reports how many were lost
+    BLOCK, // wait for the writer to make room
+}
+
+LOG_FULL_POLICY := LogFullPolicy.DROP
+
+@(private="file")
+LogRecord::struct {
+    time: time.Time,
+    level: LogLevel,
+    len: int,
+    text: [LOG_MESSAGE_SIZE]u8,
+}
+
+// Single producer (the owning thread), single consumer (whoever holds
+// `_log_writer_lock`). `head` and `tail` only ever grow.
+@(private="file")
+LogRing::struct {
+    records: [LOG_RING_SLOTS]LogRecord,
+    head, tail: int,
+    dropped: int,
+}
+
+@(private="file", thread_local) _log_ring : ^LogRing
+@(private="file") _log_rings : [dynamic]^LogRing
+@(private="file") _log_rings_lock : sync.Mutex
+
+@(private="file") _log_writer_lock : sync.Mutex
+@(private="file") _log_writer : ^thread.Thread
+@(private="file") _log_running := false
+@(private="file") _log_futex := sync.Futex(0)
+
+// Only used by the writer, kept around between batches.
+@(private="file") _log_seen : [dynamic]^LogRing
+@(private="file") _log_batch : [dynamic]^LogRecord
+@(private="file") _log_tails : [dynamic]int
+@(private="file") _log_out : [dynamic]u8
+
 init_logger::proc() {
     if !os.is_dir("logs") {
         os.make_directory("logs", 0o755)
@@ -62,88 +117,219 @@ init_logger::proc() {
         os.exit(1)
     }
 
+    sync.atomic_store(&_log_running, true)
+    _log_writer = thread.create_and_start(log_writer_loop)
+
+    // failed asserts and bounds checks end in a trap, which lands here on
+    // every thread, whatever its context
+    for sig in ([?]libc.int{libc.SIGILL, libc.SIGSEGV, libc.SIGFPE, libc.SIGABRT}) {
+        libc.signal(sig, crash_signal_handler)
+    }
+
     defer_deinit(deinit_logger)
     log(.INFO, "Initialized logger. Hello again :D")
 }
 
 deinit_logger::proc() {
     log(.INFO, "Deinitilizing logger... Goodbye :)")
+
+    sync.atomic_store(&_log_running, false)
+    sync.atomic_store(&_log_futex, 1)
+    sync.futex_signal(&_log_futex)
+    thread.join(_log_writer)
+    thread.destroy(_log_writer)
+
+    // the writer does a last pass on its way out, this catches the stragglers
+    flush_logger()
     os.close(log_file_handle)
+
+    for ring in _log_rings do free(ring)
+    delete(_log_rings)
+    delete(_log_seen)
+    delete(_log_batch)
+    delete(_log_tails)
+    delete(_log_out)
 }
 
 log::proc(level:LogLevel, msg:..any) {
-    now := time.now()
-    buf := [time.MIN_HMS_LEN]u8{}
-    timestamp := time.time_to_string_hms(now, buf[:])
+    if !sync.atomic_load_explicit(&_log_running, .Relaxed) do return
+    ring := log_ring()
 
-    log_level := ""
-    switch level {
-        case .BENCHMARK: log_level = "[BENCH]"
-        case .INFO: log_level = "[INFO]"
-        case .WARNING: log_level = "[WARN]"
-        case .ERROR: log_level = "[ERROR]"
+    tail := ring.tail
+    for tail - sync.atomic_load_explicit(&ring.head, .Acquire) >= LOG_RING_SLOTS {
+        if LOG_FULL_POLICY == .DROP && level != .ERROR {
+            sync.atomic_add_explicit(&ring.dropped, 1, .Relaxed)
+            return
+        }
+        if !sync.atomic_load(&_log_running) do return
+        sync.atomic_store(&_log_futex, 1)
+        sync.futex_signal(&_log_futex)
+        thread.yield()
     }
 
-    log_msg := new(strings.Builder)
-    defer { strings.builder_destroy(log_msg); free(log_msg) }
-    fmt.sbprintln(log_msg, ..msg)
+    record := &ring.records[tail % LOG_RING_SLOTS]
+    record.time = time.now()
+    record.level = level
+    record.len = len(fmt.bprintln(record.text[:], ..msg))
+    sync.atomic_store_explicit(&ring.tail, tail + 1, .Release)
+}
 
-    full_message := strings.concatenate([]string{timestamp, " ", log_level, " ", strings.to_string(log_msg^)})
-    defer delete(full_message)
+// Writes out everything logged so far before returning. Safe to call from
+// any thread, and about the only thing still worth doing when crashing.
+flush_logger::proc() {
+    sync.mutex_lock(&_log_writer_lock)
+    defer sync.mutex_unlock(&_log_writer_lock)
+    write_log_batch()
+}
 
-    bytes_written, err := os.write(
-        log_file_handle,
-        transmute([]u8) full_message
-    )
-    if err != nil {
-        fmt.printf("Error writing to log file: %s\n", err)
-    }
+// Use as `context.assertion_failure_proc`, so the log is written out before
+// the default handler prints the failure and traps.
+log_assertion_failure::proc(prefix, message: string, loc: runtime.Source_Code_Location) -> ! {
+    try_flush_logger()
+    runtime.default_assertion_failure_proc(prefix, message, loc)
 }
 
 assert_and_log::proc(cond: bool, msg: ..any) {
     if !cond {
         log(.ERROR, ..msg)
+        flush_logger()
         os.exit(1)
     }
 }
 
-when ENABLE_BENCHMARKS {
+// For crashes: the crashing thread may be the one holding the lock.
+@(private="file")
+try_flush_logger::proc() {
+    if !sync.mutex_try_lock(&_log_writer_lock) do return
+    defer sync.mutex_unlock(&_log_writer_lock)
+    write_log_batch()
+}
 
-    BenchmarkObject::struct {
-        name : string,
-        start : time.Tick
-    }
+// Nothing in here may allocate, format, sort or wait on a lock, so it only
+// writes out the messages that are still in the rings, bytes as they are:
+// one ring after the other, without timestamps. A message the writer is
+// busy with might come out twice, which beats not at all.
+@(private="file")
+crash_signal_handler::proc "c" (sig: libc.int) {
+    context = {} // only for calling `os.write`, which doesn't use it
 
-    bench_start::proc(name: string) -> (^BenchmarkObject) {
-        bm := new(BenchmarkObject)
-        bm.name = name
-        bm.start = time.tick_now()
-        return bm
+    // a crash in here, or on a second thread, goes straight to the default
+    if !sync.atomic_exchange(&_log_crashed, true) && sync.mutex_try_lock(&_log_rings_lock) {
+        marked := false
+        for ring in _log_rings {
+            tail := sync.atomic_load_explicit(&ring.tail, .Acquire)
+            for n in sync.atomic_load_explicit(&ring.head, .Acquire)..<tail {
+                if !marked {
+                    os.write_string(log_file_handle, "--- crashed, what's left of the log follows unsorted ---\n")
+                    marked = true
+                }
+                record := &ring.records[n % LOG_RING_SLOTS]
+                os.write_string(log_file_handle, CRASH_LEVEL_TAGS[record.level])
+                os.write(log_file_handle, record.text[:record.len])
+                if record.len == 0 || record.text[record.len-1] != '\n' do os.write_string(log_file_handle, "\n")
+            }
+        }
     }
 
-    bench_end::proc(b: ^BenchmarkObject) {
-        elapsed := time.tick_since(b.start)
-        log(.BENCHMARK, b.name, "took", elapsed)
-        free(b)
-    }
+    libc.signal(sig, libc.SIG_DFL)
+    libc.raise(sig)
+}
+
+@(private="file") _log_crashed := false
+
+@(private="file")
+CRASH_LEVEL_TAGS := [LogLevel]string{
+    .BENCHMARK = "[BENCH] ",
+    .INFO = "[INFO] ",
+    .WARNING = "[WARN] ",
+    .ERROR = "[ERROR] ",
+}
+
+@(private="file")
+log_ring::#force_inline proc() -> ^LogRing {
+    if _log_ring != nil do return _log_ring
+
+    ring := new(LogRing)
+    sync.mutex_lock(&_log_rings_lock)
+    append(&_log_rings, ring)
+    sync.mutex_unlock(&_log_rings_lock)
+
+    _log_ring = ring
+    return ring
+}
+
+@(private="file")
+log_writer_loop::proc() {
+    for {
+        sync.futex_wait_with_timeout(&_log_futex, 0, LOG_FLUSH_INTERVAL)
+        sync.atomic_store(&_log_futex, 0)
 
-    @(deferred_out=bench_end)
-    bench::#force_inline proc(name: string) -> ^BenchmarkObject {
-        return bench_start(name)
+        running := sync.atomic_load(&_log_running)
+        flush_logger()
+        if !running do break
     }
+}
+
+// Needs `_log_writer_lock`.
+@(private="file")
+write_log_batch::proc() {
+    clear(&_log_batch)
+    clear(&_log_out)
 
-} else {
+    // copied, a thread adding its ring meanwhile may move the array
+    sync.mutex_lock(&_log_rings_lock)
+    resize(&_log_seen, len(_log_rings))
+    copy(_log_seen[:], _log_rings[:])
+    sync.mutex_unlock(&_log_rings_lock)
+    rings := _log_seen[:]
+    resize(&_log_tails, len(rings))
 
-    bench_start::#force_inline proc(name: string) -> (rawptr) {
-        return nil
+    dropped := 0
+    for ring, i in rings {
+        _log_tails[i] = sync.atomic_load_explicit(&ring.tail, .Acquire)
+        for n in ring.head..<_log_tails[i] do append(&_log_batch, &ring.records[n % LOG_RING_SLOTS])
+        dropped += sync.atomic_exchange_explicit(&ring.dropped, 0, .Relaxed)
     }
+    if len(_log_batch) == 0 && dropped == 0 do return
 
-    @(disabled=true)
-    bench_end::#force_inline proc(b: rawptr) {
+    // stable, so each thread's messages keep their order when the times tie
+    slice.stable_sort_by(_log_batch[:], proc(a, b: ^LogRecord) -> bool {
+        return time.diff(b.time, a.time) < 0
+    })
+
+    for record in _log_batch {
+        append_log_line(record.time, record.level, string(record.text[:record.len]))
+    }
+    if dropped > 0 {
+        buf : [64]u8
+        append_log_line(time.now(), .WARNING, fmt.bprintln(buf[:], "Log was full, dropped", dropped, "messages"))
     }
-    
-    @(disabled=true)
-    bench::#force_inline proc(name: string) {
+
+    // the slots are free again once they're formatted
+    for ring, i in rings do sync.atomic_store_explicit(&ring.head, _log_tails[i], .Release)
+
+    if _, err := os.write(log_file_handle, _log_out[:]); err != nil {
+        fmt.printf("Error writing to log file: %s\n", err)
     }
 }
 
+@(private="file")
+append_log_line::proc(t: time.Time, level: LogLevel, text: string) {
+    buf := [time.MIN_HMS_LEN]u8{}
+    timestamp := time.time_to_string_hms(t, buf[:])
+
+    log_level := ""
+    switch level {
+        case .BENCHMARK: log_level = "[BENCH]"
+        case .INFO: log_level = "[INFO]"
+        case .WARNING: log_level = "[WARN]"
+        case .ERROR: log_level = "[ERROR]"
+    }
+
+    append(&_log_out, timestamp)
+    append(&_log_out, " ")
+    append(&_log_out, log_level)
+    append(&_log_out, " ")
+    append(&_log_out, text)
+    if !strings.has_suffix(text, "\n") do append(&_log_out, "\n")
+}
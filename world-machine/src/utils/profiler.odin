@@ -0,0 +1,382 @@
+package utils
+
+import "core:fmt"
+import "core:os"
+import "core:slice"
+import "core:strings"
+import "core:sync"
+import "core:time"
+
+// With ENABLE_BENCHMARKS, `bench` times the scope it's called in. Scopes
+// nest, one opened inside another is part of it. Opening and closing a scope
+// only writes into a fixed ring of the thread's own, the main thread reads
+// every ring once a frame in `collect_profile`.
+//
+// Stats are kept per root scope, the outermost one open on its thread: every
+// "main_loop" is one frame and every "tick" one tick. A scope gets one sample
+// per root it ran under, the total time it took in it, so "move_center" under
+// "main_loop" is its time per frame. Without ENABLE_BENCHMARKS all of this
+// compiles away.
+//
+// Scope names are kept by reference, so they have to be string literals or
+// otherwise outlive the profiler.
+
+// Set to a file name to record the whole session as a Chrome trace.
+PROFILE_TRACE_FILE :: #config(PROFILE_TRACE_FILE, "")
+
+when ENABLE_BENCHMARKS {
+
+    PROFILE_RING_SIZE :: 1 << 14 // scopes per thread, anything not collected in time gets overwritten
+    PROFILE_WINDOW :: 256        // samples kept per scope
+
+    ProfileStats::struct {
+        root, name: string,
+        samples: int,
+        min, avg, p99, max: time.Duration,
+    }
+
+    BenchScope::distinct int
+
+    @(private="file")
+    ProfileEvent::struct {
+        name: string,
+        start, end: i64, // end stays 0 while the scope is open
+        depth: i32,
+    }
+
+    @(private="file")
+    ProfileThread::struct {
+        events: [PROFILE_RING_SIZE]ProfileEvent,
+        next: int,   // only written by the owning thread
+        depth: i32,
+        cursor: int, // where collecting left off
+        id: int,
+    }
+
+    @(private="file")
+    ProfileKey::struct {
+        root, name: string,
+    }
+
+    @(private="file")
+    ProfileHistory::struct {
+        samples: [PROFILE_WINDOW]i64,
+        count: int,
+    }
+
+    @(private="file")
+    CapturedEvent::struct {
+        name: string,
+        thread: int,
+        start, end: i64,
+    }
+
+    @(private="file", thread_local) _profile_thread : ^ProfileThread
+    @(private="file") _profile_threads : [dynamic]^ProfileThread
+    @(private="file") _profile_lock : sync.Mutex // for everything but opening and closing scopes
+
+    @(private="file") _profile_history : map[ProfileKey]^ProfileHistory
+    @(private="file") _profile_totals : [dynamic]ProfileKey // scratch, one root's scopes
+    @(private="file") _profile_durations : [dynamic]i64
+    @(private="file") _profile_events : [dynamic]ProfileEvent // scratch, one root and what ran under it
+    @(private="file") _profile_lost := 0
+
+    @(private="file") _capturing := false
+    @(private="file") _capture : [dynamic]CapturedEvent
+
+    init_profiler::proc() {
+        if PROFILE_TRACE_FILE != "" do begin_profile_capture()
+        defer_deinit(deinit_profiler)
+    }
+
+    @(private="file")
+    deinit_profiler::proc() {
+        collect_profile()
+        if PROFILE_TRACE_FILE != "" do end_profile_capture(PROFILE_TRACE_FILE)
+        log_profile_stats()
+
+        // the rings stay, threads that are still shutting down may write to them
+        for _, history in _profile_history do free(history)
+        delete(_profile_history)
+        delete(_profile_totals)
+        delete(_profile_durations)
+        delete(_profile_events)
+        delete(_capture)
+    }
+
+    bench_start::proc(name: string) -> BenchScope {
+        t := profile_thread()
+        index := t.next
+        // `next` has to be out before the slot gets written over, see `collect_thread`
+        sync.atomic_thread_fence(.Release)
+        event := &t.events[index % PROFILE_RING_SIZE]
+        event.name = name
+        event.depth = t.depth
+        sync.atomic_store_explicit(&event.end, 0, .Relaxed)
+        event.start = time.tick_now()._nsec
+        t.depth += 1
+        sync.atomic_store_explicit(&t.next, index + 1, .Release)
+        return BenchScope(index)
+    }
+
+    bench_end::proc(scope: BenchScope) {
+        end := time.tick_now()._nsec
+        t := _profile_thread
+        t.depth -= 1
+        if t.next - int(scope) > PROFILE_RING_SIZE do return // overwritten since
+        sync.atomic_store_explicit(&t.events[int(scope) % PROFILE_RING_SIZE].end, max(end, 1), .Release)
+    }
+
+    @(deferred_out=bench_end)
+    bench::#force_inline proc(name: string) -> BenchScope {
+        return bench_start(name)
+    }
+
+    // Turns the scopes closed since the last call into stats. Once a frame
+    // on the main thread, roots still open are picked up next time.
+    collect_profile::proc() {
+        sync.mutex_lock(&_profile_lock)
+        defer sync.mutex_unlock(&_profile_lock)
+
+        for t in _profile_threads do collect_thread(t)
+    }
+
+    get_scope_stats::proc(root, name: string) -> (stats: ProfileStats, ok: bool) {
+        sync.mutex_lock(&_profile_lock)
+        defer sync.mutex_unlock(&_profile_lock)
+
+        history := _profile_history[ProfileKey{root, name}] or_return
+        return history_stats(ProfileKey{root, name}, history), true
+    }
+
+    // Sorted by root, then by name.
+    get_profile_stats::proc(allocator := context.allocator) -> []ProfileStats {
+        sync.mutex_lock(&_profile_lock)
+        defer sync.mutex_unlock(&_profile_lock)
+
+        stats := make([dynamic]ProfileStats, 0, len(_profile_history), allocator)
+        for key, history in _profile_history do append(&stats, history_stats(key, history))
+        slice.sort_by(stats[:], proc(a, b: ProfileStats) -> bool {
+            if a.root != b.root do return a.root < b.root
+            return a.name < b.name
+        })
+        return stats[:]
+    }
+
+    log_profile_stats::proc() {
+        stats := get_profile_stats()
+        defer delete(stats)
+
+        for s in stats {
+            log(.BENCHMARK, s.root, ">", s.name, "min", s.min, "avg", s.avg, "p99", s.p99, "max", s.max, "over", s.samples)
+        }
+        if _profile_lost > 0 do log(.BENCHMARK, "Profiler rings overflowed,", _profile_lost, "scopes lost")
+    }
+
+    // Records every scope until `end_profile_capture`, which writes them out
+    // in Chrome's trace event format (chrome://tracing, Perfetto).
+    begin_profile_capture::proc() {
+        sync.mutex_lock(&_profile_lock)
+        defer sync.mutex_unlock(&_profile_lock)
+        clear(&_capture)
+        _capturing = true
+    }
+
+    end_profile_capture::proc(path: string) -> (ok: bool) {
+        collect_profile()
+
+        sync.mutex_lock(&_profile_lock)
+        defer sync.mutex_unlock(&_profile_lock)
+        _capturing = false
+        if len(_capture) == 0 do return false
+
+        base := _capture[0].start
+        for event in _capture do base = min(base, event.start)
+
+        sb := strings.builder_make()
+        defer strings.builder_destroy(&sb)
+
+        strings.write_string(&sb, "{\"traceEvents\":[\n")
+        for event, i in _capture {
+            fmt.sbprintf(&sb, "{\"name\":%q,\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                event.name, event.thread,
+                f64(event.start - base) / 1e3, f64(event.end - event.start) / 1e3,
+                i + 1 < len(_capture) ? "," : "")
+        }
+        strings.write_string(&sb, "],\"displayTimeUnit\":\"ms\"}\n")
+
+        if !os.write_entire_file(path, sb.buf[:]) {
+            log(.ERROR, "Failed to write trace to", path)
+            return false
+        }
+        log(.INFO, "Wrote", len(_capture), "scopes to", path)
+        clear(&_capture)
+        return true
+    }
+
+    @(private="file")
+    profile_thread::#force_inline proc() -> ^ProfileThread {
+        if _profile_thread != nil do return _profile_thread
+
+        t := new(ProfileThread)
+        sync.mutex_lock(&_profile_lock)
+        t.id = len(_profile_threads)
+        append(&_profile_threads, t)
+        sync.mutex_unlock(&_profile_lock)
+
+        _profile_thread = t
+        return t
+    }
+
+    // Needs `_profile_lock`. The owning thread keeps writing while we read,
+    // and once it comes around the ring it writes over what we're reading.
+    // So events get copied out first and only used if `next` says the ring
+    // didn't get to them meanwhile, like reading a seqlock.
+    @(private="file")
+    collect_thread::proc(t: ^ProfileThread) {
+        published := skip_overwritten(t)
+
+        for t.cursor < published {
+            clear(&_profile_events)
+            root := copy_event(t, t.cursor)
+            append(&_profile_events, root)
+
+            last := t.cursor + 1
+            if root.depth == 0 && root.end != 0 {
+                // everything opened under a root is closed once it is, and comes
+                // right after it. Anything opened before it closed is published now.
+                published = sync.atomic_load_explicit(&t.next, .Acquire)
+                for last < published {
+                    event := copy_event(t, last)
+                    if event.depth == 0 do break
+                    append(&_profile_events, event)
+                    last += 1
+                }
+            }
+
+            // the root is the oldest of them, if it's still there so is the rest
+            sync.atomic_thread_fence(.Acquire)
+            if sync.atomic_load_explicit(&t.next, .Relaxed) - t.cursor >= PROFILE_RING_SIZE {
+                published = skip_overwritten(t)
+                continue
+            }
+
+            if root.depth != 0 {
+                // its root got overwritten
+                t.cursor += 1
+                continue
+            }
+            if root.end == 0 do break
+
+            clear(&_profile_totals)
+            clear(&_profile_durations)
+            for event in _profile_events {
+                if event.end == 0 do continue // overwritten before it closed
+
+                add_to_totals(ProfileKey{root.name, event.name}, event.end - event.start)
+                if _capturing do append(&_capture, CapturedEvent{event.name, t.id, event.start, event.end})
+            }
+            for key, i in _profile_totals do add_sample(key, _profile_durations[i])
+
+            t.cursor = last
+        }
+    }
+
+    // Moves the cursor past every event the ring may have come around to,
+    // including the one that might be getting written right now.
+    @(private="file")
+    skip_overwritten::proc(t: ^ProfileThread) -> (published: int) {
+        published = sync.atomic_load_explicit(&t.next, .Acquire)
+        if published - t.cursor >= PROFILE_RING_SIZE {
+            oldest := published - PROFILE_RING_SIZE + 1
+            _profile_lost += oldest - t.cursor
+            t.cursor = oldest
+        }
+        return published
+    }
+
+    @(private="file")
+    copy_event::#force_inline proc(t: ^ProfileThread, index: int) -> (event: ProfileEvent) {
+        slot := &t.events[index % PROFILE_RING_SIZE]
+        event.end = sync.atomic_load_explicit(&slot.end, .Acquire)
+        event.name, event.start, event.depth = slot.name, slot.start, slot.depth
+        return event
+    }
+
+    // A root rarely holds more than a handful of different scopes.
+    @(private="file")
+    add_to_totals::proc(key: ProfileKey, duration: i64) {
+        for k, i in _profile_totals {
+            if k == key {
+                _profile_durations[i] += duration
+                return
+            }
+        }
+        append(&_profile_totals, key)
+        append(&_profile_durations, duration)
+    }
+
+    @(private="file")
+    add_sample::proc(key: ProfileKey, duration: i64) {
+        history := _profile_history[key]
+        if history == nil {
+            history = new(ProfileHistory)
+            _profile_history[key] = history
+        }
+        history.samples[history.count % PROFILE_WINDOW] = duration
+        history.count += 1
+    }
+
+    @(private="file")
+    history_stats::proc(key: ProfileKey, history: ^ProfileHistory) -> (stats: ProfileStats) {
+        n := min(history.count, PROFILE_WINDOW)
+        sorted := history.samples
+        slice.sort(sorted[:n])
+
+        sum := i64(0)
+        for sample in sorted[:n] do sum += sample
+
+        stats.root, stats.name = key.root, key.name
+        stats.samples = n
+        stats.min = time.Duration(sorted[0])
+        stats.max = time.Duration(sorted[n - 1])
+        stats.avg = time.Duration(sum / i64(n))
+        stats.p99 = time.Duration(sorted[min(n - 1, n * 99 / 100)])
+        return stats
+    }
+
+} else {
+
+    BenchScope::struct {}
+
+    init_profiler::#force_inline proc() {
+    }
+
+    bench_start::#force_inline proc(name: string) -> BenchScope {
+        return {}
+    }
+
+    @(disabled=true)
+    bench_end::#force_inline proc(scope: BenchScope) {
+    }
+
+    @(disabled=true)
+    bench::#force_inline proc(name: string) {
+    }
+
+    @(disabled=true)
+    collect_profile::#force_inline proc() {
+    }
+
+    @(disabled=true)
+    log_profile_stats::#force_inline proc() {
+    }
+
+    @(disabled=true)
+    begin_profile_capture::#force_inline proc() {
+    }
+
+    end_profile_capture::#force_inline proc(path: string) -> (ok: bool) {
+        return false
+    }
+}
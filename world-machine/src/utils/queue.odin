@@ -90,74 +90,133 @@ len_regular::#force_inline proc(q: Queue($T)) -> int {
 // Use this if you're sure the queue is only filled by one thread
 // and emptied by another. This is a little bit faster than the
 // regular queue since it doesn't use a futex.
+//
+// It's a chain of ring buffers instead of a single one. When the producer
+// runs out of space it links a bigger segment and moves on, the consumer
+// frees the old one once it has drained it. That way neither side ever
+// touches memory the other one might be resizing.
+//
+// Anything that walks the segments (`is_empty`, `len`, `call_for_all`) is
+// for the consumer only: the producer could be reading a segment the
+// consumer just freed. Producers can't ask how full the queue is.
 OneToOneQueue::struct($T:typeid) {
+    head_segment: ^QueueSegment(T), // owned by the consumer
+    tail_segment: ^QueueSegment(T), // owned by the producer
+}
+
+QueueSegment::struct($T:typeid) {
     data: [^]T,
     capacity: int,
     head, tail: int,
+    next: ^QueueSegment(T),
 }
 
 @(require_results)
 create_one_to_one_queue::proc($T:typeid, capacity:int = 16) -> OneToOneQueue(T) {
-    data_ptr, _ := mem.alloc(capacity * size_of(T))
-    result := OneToOneQueue(T){
-        data = transmute(^T)data_ptr,
-        capacity = capacity,
-        head = 0,
-        tail = 0,
+    segment := create_queue_segment(T, capacity)
+    return OneToOneQueue(T){
+        head_segment = segment,
+        tail_segment = segment,
     }
-    return result
+}
+
+@(private="file")
+create_queue_segment::proc($T:typeid, capacity: int) -> ^QueueSegment(T) {
+    data_ptr, _ := mem.alloc(capacity * size_of(T))
+    segment := new(QueueSegment(T))
+    segment.data = transmute([^]T)data_ptr
+    segment.capacity = capacity
+    return segment
+}
+
+@(private="file")
+free_queue_segment::proc(segment: ^QueueSegment($T)) {
+    free(segment.data)
+    free(segment)
 }
 
 destroy_one_to_one_queue::proc(q: ^OneToOneQueue($T)) {
-    ptr := q.data
-    q.data = nil
-    free(ptr)
+    segment := q.head_segment
+    for segment != nil {
+        next := segment.next
+        free_queue_segment(segment)
+        segment = next
+    }
+    q.head_segment = nil
+    q.tail_segment = nil
 }
 
+// Producer only. Links a segment twice the size of the current one.
 expand_one_to_one_queue::proc(q: ^OneToOneQueue($T)) {
-    new_ptr, _ := mem.resize(q.data, q.capacity*size_of(T), q.capacity*2*size_of(T))
-    q.data = transmute(^T)new_ptr
-    copy(q.data[q.tail + q.capacity:q.capacity*2], q.data[q.tail:q.capacity])
-    q.head += q.capacity
-    q.capacity *= 2
+    segment := create_queue_segment(T, q.tail_segment.capacity * 2)
+    sync.atomic_store(&q.tail_segment.next, segment)
+    q.tail_segment = segment
 }
 
 enqueue_one_to_one::proc(q: ^OneToOneQueue($T), elem: T) {
-    assert(q.data != nil, "Queue is not initialized or destroyed")
-    if q.head == (q.tail+1) % q.capacity do expand_queue(q)
-    q.data[q.tail] = elem
-    sync.atomic_store(&q.tail, (q.tail + 1) % q.capacity)
+    assert(q.tail_segment != nil, "Queue is not initialized or destroyed")
+    segment := q.tail_segment
+    if sync.atomic_load(&segment.head) == (segment.tail+1) % segment.capacity {
+        expand_queue(q)
+        segment = q.tail_segment
+    }
+    segment.data[segment.tail] = elem
+    sync.atomic_store(&segment.tail, (segment.tail + 1) % segment.capacity)
 }
 
 dequeue_one_to_one::proc(q: ^OneToOneQueue($T)) -> (elem: T, ok: bool) #optional_ok {
-    assert(q.data != nil, "Queue is not initialized or destroyed")
-    if is_empty(q) do return T{}, false
-    elem = q.data[q.head]
-    sync.atomic_store(&q.head, (q.head + 1) % q.capacity)
-    return elem, true
+    assert(q.head_segment != nil, "Queue is not initialized or destroyed")
+    for {
+        segment := q.head_segment
+        if segment.head != sync.atomic_load(&segment.tail) {
+            elem = segment.data[segment.head]
+            sync.atomic_store(&segment.head, (segment.head + 1) % segment.capacity)
+            return elem, true
+        }
+
+        next := sync.atomic_load(&segment.next)
+        if next == nil do return T{}, false
+
+        // the producer only links a new segment after its last write to
+        // this one, so if it's still empty now it's empty for good
+        if segment.head != sync.atomic_load(&segment.tail) do continue
+        q.head_segment = next
+        free_queue_segment(segment)
+    }
 }
 
+// Consumer only.
 is_empty_one_to_one::proc(q: ^OneToOneQueue($T)) -> bool {
-    return q.head == q.tail
+    for segment := q.head_segment; segment != nil; segment = sync.atomic_load(&segment.next) {
+        if segment.head != sync.atomic_load(&segment.tail) do return false
+    }
+    return true
 }
 
+// Only while nobody enqueues, or from the consumer if the producer isn't
+// running anymore.
 call_for_all_one_to_one::proc(q: ^OneToOneQueue($T), curry: $C, f: proc(elem: T, curry: C)) {
-    if is_empty_one_to_one(q) do return
-    if q.head < q.tail {
-        for i in q.head..<q.tail {
-            f(q.data[i], curry)
-        }
-    } else {
-        for i in q.head..<q.capacity {
-            f(q.data[i], curry)
-        }
-        for i in 0..<q.tail {
-            f(q.data[i], curry)
+    for segment := q.head_segment; segment != nil; segment = segment.next {
+        if segment.head == segment.tail do continue
+        if segment.head < segment.tail {
+            for i in segment.head..<segment.tail {
+                f(segment.data[i], curry)
+            }
+        } else {
+            for i in segment.head..<segment.capacity {
+                f(segment.data[i], curry)
+            }
+            for i in 0..<segment.tail {
+                f(segment.data[i], curry)
+            }
         }
     }
 }
 
-len_one_to_one::#force_inline proc(q: OneToOneQueue($T)) -> int {
-    return (q.tail - q.head) %% q.capacity
+// Consumer only, elements enqueued meanwhile may or may not be counted.
+len_one_to_one::#force_inline proc(q: OneToOneQueue($T)) -> (count: int) {
+    for segment := q.head_segment; segment != nil; segment = sync.atomic_load(&segment.next) {
+        count += (sync.atomic_load(&segment.tail) - segment.head) %% segment.capacity
+    }
+    return count
 }
-
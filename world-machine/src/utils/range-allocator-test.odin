@@ -0,0 +1,237 @@
+package utils
+
+import "core:log"
+import "core:math/rand"
+import "core:testing"
+import "core:time"
+
+// Random churn against the allocator, with its whole state checked against
+// what the test thinks is allocated after every step.
+
+@(private="file") CHURN_STEPS :: 1 << 13
+@(private="file") CHURN_LIVE :: 256
+@(private="file") CHURN_MAX_SIZE :: 512
+
+@(private="file")
+LiveRange::struct {
+    handle: RangeHandle,
+    size: u32,
+}
+
+@(test)
+test_range_allocator_churn::proc(t: ^testing.T) {
+    a := create_range_allocator(1024)
+    defer destroy_range_allocator(&a)
+    live := make([dynamic]LiveRange)
+    defer delete(live)
+
+    for step in 0..<CHURN_STEPS {
+        switch {
+        case len(live) < CHURN_LIVE && rand.int_max(3) == 0:
+            size := random_range_size()
+            h, offset := alloc_range(&a, size)
+            testing.expect_value(t, range_offset(&a, h), offset)
+            append(&live, LiveRange{h, size})
+        case len(live) > 0 && rand.int_max(2) == 0:
+            i := rand.int_max(len(live))
+            free_range(&a, live[i].handle)
+            unordered_remove(&live, i)
+        case len(live) > 0:
+            i := rand.int_max(len(live))
+            size := random_range_size()
+            h, offset, moved := resize_range(&a, live[i].handle, size)
+            testing.expect_value(t, range_offset(&a, h), offset)
+            testing.expect(t, moved || h == live[i].handle, "resizing in place changed the handle")
+            live[i] = LiveRange{h, size}
+        }
+        if !check_ranges(t, &a, live[:]) {
+            log.errorf("after step %d", step)
+            return
+        }
+    }
+}
+
+@(test)
+test_range_allocator_merges_neighbours::proc(t: ^testing.T) {
+    a := create_range_allocator(300)
+    defer destroy_range_allocator(&a)
+
+    first, _ := alloc_range(&a, 100)
+    middle, _ := alloc_range(&a, 100)
+    last, _ := alloc_range(&a, 100)
+    testing.expect_value(t, range_allocator_stats(&a).free_ranges, 0)
+
+    // the two ends can't merge with anything but each other's free space
+    free_range(&a, first)
+    free_range(&a, last)
+    testing.expect_value(t, range_allocator_stats(&a).free_ranges, 2)
+    check_ranges(t, &a, []LiveRange{{middle, 100}})
+
+    // freeing the one in between has to leave a single free block
+    free_range(&a, middle)
+    stats := range_allocator_stats(&a)
+    testing.expect_value(t, stats.free_ranges, 1)
+    testing.expect_value(t, stats.largest_free, 300)
+    check_ranges(t, &a, {})
+
+    // and all of it fits again without growing
+    whole, offset := alloc_range(&a, 300)
+    testing.expect_value(t, offset, 0)
+    testing.expect_value(t, a.capacity, 300)
+    check_ranges(t, &a, []LiveRange{{whole, 300}})
+}
+
+// Stamps every range of a shadow buffer with its handle, compacts, copies
+// the moves in order and then every handle has to find its own stamp again.
+@(test)
+test_compact_ranges_keeps_handles::proc(t: ^testing.T) {
+    a := create_range_allocator()
+    defer destroy_range_allocator(&a)
+    live := make([dynamic]LiveRange)
+    defer delete(live)
+
+    for _ in 0..<CHURN_LIVE do append(&live, LiveRange{})
+    for &r in live {
+        r.size = random_range_size()
+        r.handle, _ = alloc_range(&a, r.size)
+    }
+    // every other one gone, so there are holes to close
+    for i := len(live) - 1; i >= 0; i -= 2 {
+        free_range(&a, live[i].handle)
+        unordered_remove(&live, i)
+    }
+    check_ranges(t, &a, live[:])
+
+    buffer := make([]RangeHandle, a.capacity)
+    defer delete(buffer)
+    for &b in buffer do b = NO_RANGE
+    for r in live {
+        offset := range_offset(&a, r.handle)
+        for &b in buffer[offset:][:r.size] do b = r.handle
+    }
+
+    moves := make([dynamic]RangeMove)
+    defer delete(moves)
+    capacity := a.capacity
+    compact_ranges(&a, &moves)
+    testing.expect(t, len(moves) > 0, "nothing moved")
+    testing.expect_value(t, a.capacity, capacity)
+
+    for m in moves do copy(buffer[m.to:][:m.size], buffer[m.from:][:m.size])
+    for r in live {
+        offset := range_offset(&a, r.handle)
+        for b in buffer[offset:][:r.size] {
+            if b != r.handle {
+                testing.expectf(t, false, "range %d at %d holds data of %d after compacting", r.handle, offset, b)
+                break
+            }
+        }
+    }
+
+    stats := range_allocator_stats(&a)
+    testing.expect_value(t, stats.free_ranges, 1)
+    testing.expect_value(t, stats.fragmentation, 0)
+    check_ranges(t, &a, live[:])
+
+    // the handles still work for everything else too
+    for r in live do free_range(&a, r.handle)
+    check_ranges(t, &a, {})
+}
+
+when ENABLE_BENCHMARKS {
+
+    // Keeps a few thousand chunk sized ranges alive and keeps resizing and
+    // replacing them, like the renderer does while the player moves around.
+    @(test)
+    bench_range_allocator::proc(t: ^testing.T) {
+        ITERATIONS :: 1 << 18
+        LIVE :: 4096
+
+        a := create_range_allocator()
+        defer destroy_range_allocator(&a)
+
+        live := make([]RangeHandle, LIVE)
+        defer delete(live)
+        for &h in live do h, _ = alloc_range(&a, 1 + u32(rand.int_max(2048)))
+
+        start := time.tick_now()
+        for _ in 0..<ITERATIONS {
+            i := rand.int_max(LIVE)
+            if rand.int_max(2) == 0 {
+                live[i], _, _ = resize_range(&a, live[i], 1 + u32(rand.int_max(2048)))
+            } else {
+                free_range(&a, live[i])
+                live[i], _ = alloc_range(&a, 1 + u32(rand.int_max(2048)))
+            }
+        }
+        seconds := time.duration_seconds(time.tick_since(start))
+
+        stats := range_allocator_stats(&a)
+        log.infof("range allocator: %.0f ops/sec, utilization %.3f, fragmentation %.3f",
+            f64(ITERATIONS) / seconds, f32(stats.used) / f32(stats.capacity), stats.fragmentation)
+    }
+
+}
+
+@(private="file")
+random_range_size::proc() -> u32 {
+    // mostly small, now and then something big enough to force a grow
+    if rand.int_max(16) == 0 do return 1 + u32(rand.int_max(8 * CHURN_MAX_SIZE))
+    return 1 + u32(rand.int_max(CHURN_MAX_SIZE))
+}
+
+// Walks the blocks in address order: they have to tile the whole capacity
+// without gaps or overlaps, no two free ones may sit next to each other,
+// `used` has to add up, and every live range has to be there at its size.
+// The free ones have to be in the right bins.
+@(private="file")
+check_ranges::proc(t: ^testing.T, a: ^RangeAllocator, live: []LiveRange) -> bool {
+    allocated := make(map[RangeHandle]u32)
+    defer delete(allocated)
+    for r in live do allocated[r.handle] = r.size
+
+    end := u32(0)
+    used := u32(0)
+    free_blocks := 0
+    prev := NO_RANGE
+    prev_free := false
+    for h := a.first; h != NO_RANGE; h = a.blocks[h].next {
+        block := a.blocks[h]
+        testing.expectf(t, block.offset == end, "range %d starts at %d, the one before ends at %d", h, block.offset, end) or_return
+        testing.expectf(t, block.size > 0, "range %d is empty", h) or_return
+        testing.expectf(t, block.prev == prev, "range %d links back to %d instead of %d", h, block.prev, prev) or_return
+        end = block.offset + block.size
+
+        if block.free {
+            testing.expectf(t, !prev_free, "free range %d wasn't merged with the free one before it", h) or_return
+            testing.expectf(t, h not_in allocated, "live range %d is marked free", h) or_return
+            free_blocks += 1
+        } else {
+            size, ok := allocated[h]
+            testing.expectf(t, ok, "range %d is allocated but nobody owns it", h) or_return
+            testing.expectf(t, block.size == size, "range %d is %d long instead of %d", h, block.size, size) or_return
+            delete_key(&allocated, h)
+            used += block.size
+        }
+        prev = h
+        prev_free = block.free
+    }
+    testing.expectf(t, a.last == prev, "last range is %d instead of %d", a.last, prev) or_return
+    testing.expectf(t, end == a.capacity, "ranges end at %d, the capacity is %d", end, a.capacity) or_return
+    testing.expectf(t, used == a.used, "live ranges add up to %d, used is %d", used, a.used) or_return
+    testing.expectf(t, len(allocated) == 0, "%d live ranges are missing", len(allocated)) or_return
+
+    binned := 0
+    for bin, i in a.bins {
+        testing.expectf(t, (bin != NO_RANGE) == (a.bin_mask & (1 << u32(i)) != 0), "bin mask is wrong for bin %d", i) or_return
+        for h := bin; h != NO_RANGE; h = a.blocks[h].free_next {
+            block := a.blocks[h]
+            testing.expectf(t, block.free, "range %d is in a bin but not free", h) or_return
+            testing.expectf(t, block.size >= 1 << u32(i) && (i == RANGE_BINS - 1 || block.size < 1 << u32(i + 1)),
+                "range %d of size %d is in bin %d", h, block.size, i) or_return
+            binned += 1
+        }
+    }
+    testing.expectf(t, binned == free_blocks, "%d ranges are binned but %d are free", binned, free_blocks) or_return
+    return true
+}
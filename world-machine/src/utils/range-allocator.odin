@@ -0,0 +1,329 @@
+package utils
+
+import "core:math/bits"
+
+// Hands out ranges of a linear buffer (the chunk instance buffer, mostly).
+// Free ranges sit in one free list per power of two of their size, so
+// finding one is a bitmask lookup, and freed ranges merge with their free
+// neighbours. Nothing here touches the memory itself, the caller owns it.
+RangeAllocator::struct {
+    blocks: [dynamic]RangeBlock,
+    unused_blocks: [dynamic]RangeHandle, // entries of `blocks` that can be reused
+    bins: [RANGE_BINS]RangeHandle,
+    bin_mask: u32, // bit i is set when bins[i] isn't empty
+    first, last: RangeHandle, // in address order
+    capacity: u32,
+    used: u32,
+}
+
+RANGE_BINS :: 32
+
+// How many blocks of the best fitting bin get looked at before settling
+// for a block from a bigger bin, which always fits.
+@(private="file") RANGE_BIN_SCAN :: 8
+
+// Stays the same for as long as the range is allocated, even if it moves.
+RangeHandle::distinct i32
+NO_RANGE :: RangeHandle(-1)
+
+RangeBlock::struct {
+    offset, size: u32,
+    prev, next: RangeHandle,           // neighbours in the buffer
+    free_prev, free_next: RangeHandle, // neighbours in the bin, only while free
+    free: bool,
+}
+
+RangeStats::struct {
+    capacity, used, free: u32,
+    largest_free: u32,
+    free_ranges: int,
+    fragmentation: f32, // 0 when all the free space is in one piece
+}
+
+// A range that `compact_ranges` slid down.
+RangeMove::struct {
+    handle: RangeHandle,
+    from, to, size: u32,
+}
+
+@(require_results)
+create_range_allocator::proc(capacity: u32 = 0) -> RangeAllocator {
+    a := RangeAllocator{
+        first = NO_RANGE,
+        last = NO_RANGE,
+    }
+    for &bin in a.bins do bin = NO_RANGE
+    if capacity > 0 do grow_ranges(&a, capacity)
+    return a
+}
+
+destroy_range_allocator::proc(a: ^RangeAllocator) {
+    delete(a.blocks)
+    delete(a.unused_blocks)
+    a^ = {}
+}
+
+// Grows the capacity if nothing fits, the caller has to grow its buffer
+// to match afterwards.
+alloc_range::proc(a: ^RangeAllocator, size: u32) -> (handle: RangeHandle, offset: u32) {
+    assert(size > 0)
+
+    handle = find_free_range(a, size)
+    if handle == NO_RANGE {
+        grow_ranges(a, max(size, a.capacity / 2))
+        handle = find_free_range(a, size)
+        assert(handle != NO_RANGE)
+    }
+
+    unbin_range(a, handle)
+    split_range(a, handle, size)
+    a.blocks[handle].free = false
+    a.used += size
+    return handle, a.blocks[handle].offset
+}
+
+free_range::proc(a: ^RangeAllocator, handle: RangeHandle) {
+    block := &a.blocks[handle]
+    assert(!block.free, "Range freed twice")
+    a.used -= block.size
+    release_range(a, handle)
+}
+
+// Grows in place when the space after the range is free, otherwise the
+// range moves and the caller has to move its data along.
+resize_range::proc(a: ^RangeAllocator, handle: RangeHandle, size: u32) -> (new_handle: RangeHandle, offset: u32, moved: bool) {
+    assert(size > 0)
+    block := &a.blocks[handle]
+    old_size := block.size
+
+    if size <= old_size {
+        split_range(a, handle, size)
+        a.used -= old_size - size
+        return handle, a.blocks[handle].offset, false
+    }
+
+    next := block.next
+    if next != NO_RANGE && a.blocks[next].free && old_size + a.blocks[next].size >= size {
+        unbin_range(a, next)
+        block.size += a.blocks[next].size
+        unlink_range(a, next)
+        split_range(a, handle, size)
+        a.used += size - old_size
+        return handle, a.blocks[handle].offset, false
+    }
+
+    // allocating first, so the old and new ranges never overlap
+    new_handle, offset = alloc_range(a, size)
+    free_range(a, handle)
+    return new_handle, offset, true
+}
+
+range_offset::#force_inline proc(a: ^RangeAllocator, handle: RangeHandle) -> u32 {
+    return a.blocks[handle].offset
+}
+
+// Slides every allocated range down to the start of the buffer, leaving
+// all the free space in one piece at the end. Handles stay valid. The moves
+// come in address order, so copying them in order is safe.
+compact_ranges::proc(a: ^RangeAllocator, moves: ^[dynamic]RangeMove) {
+    clear(moves)
+
+    cursor := u32(0)
+    prev := NO_RANGE
+    h := a.first
+    for h != NO_RANGE {
+        next := a.blocks[h].next
+        block := &a.blocks[h]
+
+        if block.free {
+            append(&a.unused_blocks, h)
+        } else {
+            if block.offset != cursor {
+                append(moves, RangeMove{handle = h, from = block.offset, to = cursor, size = block.size})
+                block.offset = cursor
+            }
+            cursor += block.size
+
+            block.prev = prev
+            if prev == NO_RANGE {
+                a.first = h
+            } else {
+                a.blocks[prev].next = h
+            }
+            prev = h
+        }
+        h = next
+    }
+
+    for &bin in a.bins do bin = NO_RANGE
+    a.bin_mask = 0
+    a.last = prev
+    if prev == NO_RANGE {
+        a.first = NO_RANGE
+    } else {
+        a.blocks[prev].next = NO_RANGE
+    }
+
+    // everything after the last range is one free block again
+    free_space := a.capacity - cursor
+    a.capacity = cursor
+    if free_space > 0 do grow_ranges(a, free_space)
+}
+
+range_allocator_stats::proc(a: ^RangeAllocator) -> (stats: RangeStats) {
+    stats.capacity = a.capacity
+    stats.used = a.used
+    stats.free = a.capacity - a.used
+
+    for h := a.first; h != NO_RANGE; h = a.blocks[h].next {
+        block := a.blocks[h]
+        if !block.free do continue
+        stats.free_ranges += 1
+        stats.largest_free = max(stats.largest_free, block.size)
+    }
+    if stats.free > 0 {
+        stats.fragmentation = 1 - f32(stats.largest_free) / f32(stats.free)
+    }
+    return stats
+}
+
+@(private="file")
+range_bin::#force_inline proc(size: u32) -> u32 {
+    return 31 - bits.count_leading_zeros(size)
+}
+
+@(private="file")
+find_free_range::proc(a: ^RangeAllocator, size: u32) -> RangeHandle {
+    bin := range_bin(size)
+
+    // blocks in the same bin might still be too small
+    h := a.bins[bin]
+    for _ in 0..<RANGE_BIN_SCAN {
+        if h == NO_RANGE do break
+        if a.blocks[h].size >= size do return h
+        h = a.blocks[h].free_next
+    }
+
+    // anything in a bigger bin fits
+    bigger := u64(a.bin_mask) & ~((u64(2) << bin) - 1)
+    if bigger == 0 do return NO_RANGE
+    return a.bins[bits.trailing_zeros(bigger)]
+}
+
+@(private="file")
+new_range_block::proc(a: ^RangeAllocator) -> RangeHandle {
+    if len(a.unused_blocks) > 0 do return pop(&a.unused_blocks)
+    append(&a.blocks, RangeBlock{})
+    return RangeHandle(len(a.blocks) - 1)
+}
+
+// Takes a block out of the address order, its space has to be taken
+// over by a neighbour first.
+@(private="file")
+unlink_range::proc(a: ^RangeAllocator, h: RangeHandle) {
+    block := a.blocks[h]
+    if block.prev == NO_RANGE {
+        a.first = block.next
+    } else {
+        a.blocks[block.prev].next = block.next
+    }
+    if block.next == NO_RANGE {
+        a.last = block.prev
+    } else {
+        a.blocks[block.next].prev = block.prev
+    }
+    append(&a.unused_blocks, h)
+}
+
+@(private="file")
+bin_range::proc(a: ^RangeAllocator, h: RangeHandle) {
+    block := &a.blocks[h]
+    bin := range_bin(block.size)
+    block.free = true
+    block.free_prev = NO_RANGE
+    block.free_next = a.bins[bin]
+    if a.bins[bin] != NO_RANGE do a.blocks[a.bins[bin]].free_prev = h
+    a.bins[bin] = h
+    a.bin_mask |= 1 << bin
+}
+
+@(private="file")
+unbin_range::proc(a: ^RangeAllocator, h: RangeHandle) {
+    block := &a.blocks[h]
+    bin := range_bin(block.size)
+    if block.free_prev == NO_RANGE {
+        a.bins[bin] = block.free_next
+    } else {
+        a.blocks[block.free_prev].free_next = block.free_next
+    }
+    if block.free_next != NO_RANGE do a.blocks[block.free_next].free_prev = block.free_prev
+    if a.bins[bin] == NO_RANGE do a.bin_mask &= ~(1 << bin)
+    block.free = false
+}
+
+// Cuts the block down to `size`, whatever is left over becomes free.
+@(private="file")
+split_range::proc(a: ^RangeAllocator, h: RangeHandle, size: u32) {
+    if a.blocks[h].size == size do return
+
+    rest := new_range_block(a)
+    block := &a.blocks[h] // the append above may have moved it
+    a.blocks[rest] = RangeBlock{
+        offset = block.offset + size,
+        size = block.size - size,
+        prev = h,
+        next = block.next,
+    }
+    if block.next == NO_RANGE {
+        a.last = rest
+    } else {
+        a.blocks[block.next].prev = rest
+    }
+    block.next = rest
+    block.size = size
+
+    release_range(a, rest)
+}
+
+// Marks the block free and merges it with its free neighbours.
+@(private="file")
+release_range::proc(a: ^RangeAllocator, h: RangeHandle) {
+    h := h
+
+    next := a.blocks[h].next
+    if next != NO_RANGE && a.blocks[next].free {
+        unbin_range(a, next)
+        a.blocks[h].size += a.blocks[next].size
+        unlink_range(a, next)
+    }
+
+    prev := a.blocks[h].prev
+    if prev != NO_RANGE && a.blocks[prev].free {
+        unbin_range(a, prev)
+        a.blocks[prev].size += a.blocks[h].size
+        unlink_range(a, h)
+        h = prev
+    }
+
+    bin_range(a, h)
+}
+
+@(private="file")
+grow_ranges::proc(a: ^RangeAllocator, amount: u32) {
+    h := new_range_block(a)
+    a.blocks[h] = RangeBlock{
+        offset = a.capacity,
+        size = amount,
+        prev = a.last,
+        next = NO_RANGE,
+    }
+    if a.last == NO_RANGE {
+        a.first = h
+    } else {
+        a.blocks[a.last].next = h
+    }
+    a.last = h
+    a.capacity += amount
+
+    release_range(a, h)
+}
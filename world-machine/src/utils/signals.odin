@@ -1,94 +1,231 @@
 package utils
 
-import "core:strings"
-import "core:fmt"
-import "core:slice"
+import "core:sync"
 
 init_engine_signals::proc() {
-    for i in Signals {
-        engine_signals[i] = EngineSignal{
-            listeners = new([dynamic]proc())
-        }
-    }
+    _signal_count = len(Signals)
 
     defer_deinit(deinit_signals)
 }
 
 @(private="file") deinit_signals::proc() {
-    for i in Signals {
-        delete(engine_signals[i].listeners^)
+    for &slot in _signals[:_signal_count] {
+        if slot.listeners != nil do free_listener_list(slot.listeners)
     }
+    for list in _retired_lists do free_listener_list(list)
+    delete(_retired_lists)
+    delete(_signal_names)
+
+    for queue in _deferred_queues {
+        destroy(queue)
+        free(queue)
+    }
+    delete(_deferred_queues)
 }
 
 connect::proc{
     connect_signal,
     connect_engine_signal,
+    connect_handle,
+}
+
+connect_with::proc{
+    connect_engine_signal_with,
+    connect_handle_with,
 }
 
 disconnect::proc{
     disconnect_signal,
     disconnect_engine_signal,
+    disconnect_handle,
 }
 
 emit::proc{
     emit_signal,
     emit_engine_signal,
+    emit_handle,
 }
 
-// Basic event system. Accesed with strings
-Signal::struct {
-    name : string,
-    listeners : ^[dynamic]proc()
+emit_with::proc{
+    emit_engine_signal_with,
+    emit_handle_with,
 }
 
-@(private) signals : map[string]Signal
+// Every signal, engine or named, is a slot in one fixed table and a handle
+// is its index. Named signals are looked up by name once, through
+// `signal_handle`, and used through the handle after that.
+SignalHandle::distinct u32
+
+MAX_SIGNALS :: 256
+
+// Listeners either take no arguments or a pointer to the signal's payload,
+// which is nil when the signal is emitted without one.
+// A signal only ever carries one payload type, checked when emitting.
+@(private="file")
+Listener::struct {
+    plain: proc(),
+    typed: proc(payload: rawptr),
+}
+
+// Listener lists are never changed in place. Connecting or disconnecting
+// builds a new list and swaps it in, so an emit is one atomic load and never
+// sees a list halfway through a change, whatever thread it's on. Replaced
+// lists are only freed at deinit, since an emit on another thread might still
+// be going through one. Listeners come and go rarely enough for that to be fine.
+@(private="file")
+ListenerList::struct {
+    listeners: []Listener,
+}
+
+@(private="file")
+SignalSlot::struct {
+    name: string,
+    listeners: ^ListenerList, // nil until something connects
+    payload_type: typeid,     // nil until a typed listener connects
+}
+
+@(private="file") _signals : [MAX_SIGNALS]SignalSlot
+@(private="file") _signal_count := 0
+@(private="file") _signal_names : map[string]SignalHandle
+@(private="file") _retired_lists : [dynamic]^ListenerList
+@(private="file") _signals_lock : sync.Mutex // for everything but emitting
+
+// Basic event system. Accesed with strings, or better, with the handle
+// `signal_handle` returns for the string.
 
 create_signal::proc(name:string) -> (ok:bool) {
-    _, has := &signals[name]
-    if has do return false
+    sync.mutex_lock(&_signals_lock)
+    defer sync.mutex_unlock(&_signals_lock)
 
-    signals[name] = Signal{
-        name = name,
-        listeners = new([dynamic]proc())
-    }
+    if name in _signal_names do return false
+    assert(_signal_count < MAX_SIGNALS, "Too many signals")
 
+    handle := SignalHandle(_signal_count)
+    _signals[handle].name = name
+    _signal_names[name] = handle
+    _signal_count += 1
     return true
 }
 
-connect_signal::proc(name:string, to:proc()) -> (ok:bool) {
-    signal, has := &signals[name]
-    if !has do return false
+signal_handle::proc(name:string) -> (handle: SignalHandle, ok: bool) {
+    sync.mutex_lock(&_signals_lock)
+    defer sync.mutex_unlock(&_signals_lock)
+    handle, ok = _signal_names[name]
+    return handle, ok
+}
 
-    append(signal.listeners, to)
-    return true
+connect_signal::proc(name:string, to:proc()) -> (ok:bool) {
+    handle := signal_handle(name) or_return
+    return connect_handle(handle, to)
 }
 
 disconnect_signal::proc(name:string, from:proc()) -> (ok:bool) {
-    signal, has := &signals[name]
-    if !has do return false
+    handle := signal_handle(name) or_return
+    return disconnect_handle(handle, from)
+}
+
+// Looks the name up every time, keep a handle around for anything frequent.
+emit_signal::proc(name:string) {
+    if handle, ok := signal_handle(name); ok do emit_handle(handle)
+}
 
-    has = remove_elem(signal.listeners, from)
-    if !has do return false
+connect_handle::proc(signal: SignalHandle, to: proc()) -> (ok: bool) {
+    return add_listener(signal, Listener{plain = to})
+}
+
+connect_handle_with::proc(signal: SignalHandle, to: proc(payload: ^$T)) -> (ok: bool) {
+    sync.mutex_lock(&_signals_lock)
+    slot := &_signals[signal]
+    assert(slot.payload_type == nil || slot.payload_type == T, "Signal connected with two payload types")
+    slot.payload_type = T
+    sync.mutex_unlock(&_signals_lock)
 
+    return add_listener(signal, Listener{typed = transmute(proc(rawptr))to})
+}
+
+disconnect_handle::proc(signal: SignalHandle, from: proc()) -> (ok: bool) {
+    sync.mutex_lock(&_signals_lock)
+    defer sync.mutex_unlock(&_signals_lock)
+
+    old := _signals[signal].listeners
+    if old == nil do return false
+    idx := -1
+    for l, i in old.listeners {
+        if l.plain == from {
+            idx = i
+            break
+        }
+    }
+    if idx < 0 do return false
+
+    list := new(ListenerList)
+    list.listeners = make([]Listener, len(old.listeners) - 1)
+    copy(list.listeners[:idx], old.listeners[:idx])
+    copy(list.listeners[idx:], old.listeners[idx+1:])
+    swap_listener_list(signal, list)
     return true
 }
 
-emit_signal::proc(name:string) {
-    signal, has := &signals[name]
-    if !has do return
+emit_handle::proc(signal: SignalHandle) {
+    list := sync.atomic_load_explicit(&_signals[signal].listeners, .Acquire)
+    if list == nil do return
+    for listener in list.listeners {
+        if listener.plain != nil {
+            listener.plain()
+        } else {
+            listener.typed(nil)
+        }
+    }
+}
 
-    for &listener in signal.listeners {
-        listener()
+emit_handle_with::proc(signal: SignalHandle, payload: ^$T) {
+    list := sync.atomic_load_explicit(&_signals[signal].listeners, .Acquire)
+    if list == nil do return
+    assert(_signals[signal].payload_type == nil || _signals[signal].payload_type == T, "Signal emitted with the wrong payload type")
+    for listener in list.listeners {
+        if listener.plain != nil {
+            listener.plain()
+        } else {
+            listener.typed(payload)
+        }
     }
 }
 
-// We also have dedicated signals to use within the engine
-// These aren't tied to a string name for extra performance
+@(private="file")
+add_listener::proc(signal: SignalHandle, listener: Listener) -> (ok: bool) {
+    sync.mutex_lock(&_signals_lock)
+    defer sync.mutex_unlock(&_signals_lock)
+
+    if int(signal) >= _signal_count do return false
+
+    old := _signals[signal].listeners
+    old_listeners : []Listener
+    if old != nil do old_listeners = old.listeners
+
+    list := new(ListenerList)
+    list.listeners = make([]Listener, len(old_listeners) + 1)
+    copy(list.listeners, old_listeners)
+    list.listeners[len(old_listeners)] = listener
+    swap_listener_list(signal, list)
+    return true
+}
+
+// Needs `_signals_lock`.
+@(private="file")
+swap_listener_list::proc(signal: SignalHandle, list: ^ListenerList) {
+    old := sync.atomic_exchange_explicit(&_signals[signal].listeners, list, .Acq_Rel)
+    if old != nil do append(&_retired_lists, old)
+}
 
-EngineSignal::struct {
-    listeners : ^[dynamic]proc()
+@(private="file")
+free_listener_list::proc(list: ^ListenerList) {
+    delete(list.listeners)
+    free(list)
 }
 
+// We also have dedicated signals to use within the engine. They sit at the
+// start of the table, so the enum value is the handle.
+
 Signals::enum {
     FRAME_START,
     FRAME_RENDER_WORLD,
@@ -101,26 +238,125 @@ Signals::enum {
     TICK_START,
     TICK_MIDDLE,
     TICK_END,
-}
 
-@(private) engine_signals : [Signals]EngineSignal
+    CHUNK_READY, // ChunkPos payload, posted deferred by whoever loads the chunk
+}
 
 connect_engine_signal::proc(signal:Signals, to:proc()) -> (ok:bool) {
-    append(engine_signals[signal].listeners, to)
-    return true
+    return connect_handle(SignalHandle(signal), to)
 }
 
-disconnect_engine_signal::proc(signal:Signals, from:proc()) -> (ok:bool) {
-    has := remove_elem(engine_signals[signal].listeners, from)
-    if !has do return false
+connect_engine_signal_with::proc(signal:Signals, to:proc(payload: ^$T)) -> (ok:bool) {
+    return connect_handle_with(SignalHandle(signal), to)
+}
 
-    return true
+disconnect_engine_signal::proc(signal:Signals, from:proc()) -> (ok:bool) {
+    return disconnect_handle(SignalHandle(signal), from)
 }
 
 emit_engine_signal::proc(signal:Signals) {
-    for &listener in engine_signals[signal].listeners {
-        listener()
+    emit_handle(SignalHandle(signal))
+}
+
+emit_engine_signal_with::proc(signal:Signals, payload: ^$T) {
+    emit_handle_with(SignalHandle(signal), payload)
+}
+
+// Deferred signals are posted on one thread and emitted on the thread that
+// calls `flush_deferred_signals` (the main thread, once per frame), in the
+// order each thread posted them. Every posting thread gets a one-to-one queue
+// of its own the first time it posts, so after that posting never locks.
+
+DEFERRED_PAYLOAD_SIZE :: 24
+
+// The payload goes first and is made of words, so it's aligned for anything
+// up to 8 bytes.
+@(private="file")
+DeferredSignal::struct {
+    payload: [DEFERRED_PAYLOAD_SIZE / 8]u64,
+    emit: proc(signal: SignalHandle, payload: rawptr), // emits with the right payload type
+    signal: SignalHandle,
+    has_payload: bool,
+}
+
+// One per posting thread, which only ever enqueues. Everything else, even
+// checking if one is empty, is left to `flush_deferred_signals`.
+@(private="file", thread_local) _deferred_queue : ^OneToOneQueue(DeferredSignal)
+@(private="file") _deferred_queues : [dynamic]^OneToOneQueue(DeferredSignal)
+@(private="file") _deferred_lock : sync.Mutex
+
+post_deferred::proc{
+    post_deferred_handle,
+    post_deferred_handle_with,
+    post_deferred_engine_signal,
+    post_deferred_engine_signal_with,
+}
+
+post_deferred_handle::proc(signal: SignalHandle) {
+    enqueue(deferred_queue(), DeferredSignal{signal = signal})
+}
+
+// The payload is copied, so it has to be small and must not point into the
+// poster's stack.
+post_deferred_handle_with::proc(signal: SignalHandle, payload: $T)
+    where size_of(T) <= DEFERRED_PAYLOAD_SIZE, align_of(T) <= 8 {
+    event := DeferredSignal{
+        signal = signal,
+        has_payload = true,
+        emit = proc(signal: SignalHandle, payload: rawptr) {
+            emit_handle_with(signal, (^T)(payload))
+        },
     }
+    (^T)(&event.payload)^ = payload
+    enqueue(deferred_queue(), event)
+}
+
+post_deferred_engine_signal::proc(signal: Signals) {
+    post_deferred_handle(SignalHandle(signal))
+}
+
+post_deferred_engine_signal_with::proc(signal: Signals, payload: $T)
+    where size_of(T) <= DEFERRED_PAYLOAD_SIZE, align_of(T) <= 8 {
+    post_deferred_handle_with(SignalHandle(signal), payload)
+}
+
+// Only ever call this from one thread.
+flush_deferred_signals::proc() {
+    // a thread can add its queue meanwhile, which may move the array
+    for i := 0; ; i += 1 {
+        sync.mutex_lock(&_deferred_lock)
+        if i >= len(_deferred_queues) {
+            sync.mutex_unlock(&_deferred_lock)
+            break
+        }
+        queue := _deferred_queues[i]
+        sync.mutex_unlock(&_deferred_lock)
+
+        for {
+            event, ok := dequeue(queue)
+            if !ok do break
+            if event.has_payload {
+                event.emit(event.signal, &event.payload)
+            } else {
+                emit_handle(event.signal)
+            }
+        }
+    }
+}
+
+@(private="file")
+deferred_queue::proc() -> ^OneToOneQueue(DeferredSignal) {
+    if _deferred_queue != nil do return _deferred_queue
+
+    queue := new(OneToOneQueue(DeferredSignal))
+    queue^ = create_one_to_one_queue(DeferredSignal, 64)
+
+    sync.mutex_lock(&_deferred_lock)
+    append(&_deferred_queues, queue)
+    sync.mutex_unlock(&_deferred_lock)
+
+    _deferred_queue = queue
+    return queue
 }
 
 // This is seperated from the main signals since we never remove these listeners
@@ -137,4 +373,3 @@ deinit_everything::proc() {
         fn()
     }
 }
-